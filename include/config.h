@@ -0,0 +1,294 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+
+/*
+ * Compile-time configuration of the allocator.
+ *
+ * Every knob is a plain constant, so the compiler folds it into the code and a
+ * variant pays nothing at run time for the features it leaves out. Pick one of
+ * the predefined variants with -DICS_VARIANT_<NAME> (`make variants` builds all
+ * of them as build/libicsmm-<name>.a) or override single knobs with
+ * -D<KNOB>=<value>. Without either, the allocator is built as it always was.
+ *
+ * Variants:
+ *   ICS_VARIANT_SMALL_LATENCY     Default block geometry with no profiling
+ *                                 hooks in the malloc/free path and the heap
+ *                                 grown by pointer bumps inside a reserved
+ *                                 region.
+ *   ICS_VARIANT_LARGE_THROUGHPUT  64-byte block granule: fewer distinct block
+ *                                 sizes, fewer splits and splinters. The heap
+ *                                 is backed by transparent huge pages.
+ *   ICS_VARIANT_HARDENED          Freed payloads are poisoned, free blocks are
+ *                                 validated before reuse and misaligned
+ *                                 pointers are rejected by ics_free.
+ *   ICS_VARIANT_THREAD_SAFE       Every thread allocates from its own heap in
+ *                                 its own reserved region; blocks freed by other
+ *                                 threads go back through a lock-free queue.
+ *   ICS_VARIANT_NUMA              ICS_VARIANT_THREAD_SAFE with every heap bound
+ *                                 to the NUMA node of its thread.
+ *   ICS_VARIANT_PERSISTENT        The heap can live in a file that later runs
+ *                                 attach to again (ics_mem_attach).
+ *   ICS_VARIANT_COMPACT           32-bit free-list links and an 8-byte granule:
+ *                                 blocks of 24 bytes for requests up to 8.
+ *   ICS_VARIANT_ADAPTIVE          At most 32 block sizes up to 1 KiB, learned
+ *                                 from the first requests of the run.
+ *
+ * Knobs:
+ *   ALIGNMENT          Payload alignment, 16 by default. 8 only pays off with
+ *                      ICS_COMPACT_LINKS, whose free blocks fit in 24 bytes.
+ *   BLOCK_GRANULE      Block sizes are rounded up to a multiple of this.
+ *   MIN_BLOCK_SIZE     Smallest block, and smallest remainder splitBlock leaves.
+ *   PAGE_SIZE          Size of one ics_inc_brk() step.
+ *   MAX_PAGES          Number of pages ics_inc_brk() hands out.
+ *   *_SIZE_BITS        Widths of the header and footer bitfields.
+ *   ICS_REGION_RESERVE 1 takes the heap from an ICS_RESERVE_SIZE byte mmap
+ *                      reservation instead of ics_inc_brk().
+ *   ICS_RESERVE_SIZE   Default bytes of address space reserved for the heap.
+ *   ICS_COMMIT_CHUNK   Size of the first commit inside the reservation.
+ *   ICS_GROWTH_FACTOR  Default factor every following commit grows by.
+ *                      ics_mem_tune() overrides both defaults at run time.
+ *   ICS_HUGEPAGES      1 aligns the reservation to HUGE_PAGE_SIZE, commits it in
+ *                      HUGE_PAGE_SIZE chunks with MADV_HUGEPAGE and places blocks
+ *                      first-fit so they stay packed in the lowest huge pages.
+ *                      Implies ICS_REGION_RESERVE.
+ *   ICS_ENGINE         Free block index. ICS_ENGINE_NEXTFIT keeps one
+ *                      address-ordered list searched next-fit; ICS_ENGINE_TLSF
+ *                      keeps a two-level segregated fit index with O(1) malloc
+ *                      and free (ics_freelist_print shows no list then);
+ *                      ICS_ENGINE_BUDDY replaces the boundary-tag blocks with a
+ *                      binary buddy system for power-of-two heavy workloads.
+ *   ICS_BUDDY_MAX_ORDER log2 of the largest buddy block, the unit the buddy
+ *                      arena grows by.
+ *   ICS_THREAD_SAFE    1 gives every thread a heap of its own. ics_free of a
+ *                      block owned by another thread pushes it onto that
+ *                      heap's remote free list with one compare-and-swap, the
+ *                      owner takes the whole list back on its next ics_malloc.
+ *                      fork() waits for all heaps to be idle, and the child
+ *                      starts with unlocked heaps.
+ *                      Needs ICS_REGION_RESERVE and ICS_PROFILE 0.
+ *   ICS_NUMA           1 binds every thread heap to the NUMA node of the thread
+ *                      that creates it and counts allocations and frees that
+ *                      cross nodes (ics_get_numa_stats). On a single node machine
+ *                      no binding is done. Needs ICS_THREAD_SAFE.
+ *   ICS_MAX_HEAPS      Number of heaps that can exist at once. The heap of an
+ *                      exited thread is adopted by the next thread that needs
+ *                      one.
+ *   ICS_CACHELINE_PAD  1 starts every payload on an ICS_CACHE_LINE boundary and
+ *                      keeps the line holding the block's footer and the next
+ *                      block's header out of it, so objects handed to different
+ *                      threads never share a line with each other or with the
+ *                      tags ics_free writes. Costs up to two lines per block.
+ *   ICS_COMPACT_LINKS  1 stores the free-list links of a free block as 32-bit
+ *                      offsets from the prologue instead of pointers, so a free
+ *                      block needs 24 bytes instead of 32 and the links do not
+ *                      depend on where the heap is mapped. The heap must stay
+ *                      below 4 GiB.
+ *   ICS_PERSISTENT     1 lets ics_mem_attach() back the heap with a file that
+ *                      keeps it across restarts. Reattaching validates every
+ *                      block and rebuilds the free list, so the file can be
+ *                      mapped at another address. Needs ICS_REGION_RESERVE
+ *                      and a single boundary-tag heap without huge pages.
+ *   ICS_SIZE_CLASSES   Number of size classes learned from the workload, 0 for
+ *                      none. ics_malloc counts the block sizes of the first
+ *                      ICS_CLASS_WARMUP requests, then picks the classes that
+ *                      waste the fewest bytes on them and rounds every block up
+ *                      to ICS_CLASS_MAX_BLOCK bytes to its class from then on.
+ *                      Fewer distinct block sizes cost internal fragmentation,
+ *                      see the README. The table can be saved with
+ *                      ics_size_classes_export() and given to the next run
+ *                      with ics_size_classes_load().
+ *   ICS_CLASS_WARMUP   Requests sampled before the classes are derived.
+ *   ICS_CLASS_MAX_BLOCK Largest block size that is rounded to a class.
+ *   ICS_PROFILE        1 compiles the sampling profiler into ics_malloc/ics_free.
+ *   ICS_HARDENED       1 enables the hardened checks described above.
+ *
+ * PAGE_SIZE and MAX_PAGES mirror lib/icsutil.o and are not meant to be tuned.
+ */
+
+
+#if defined(ICS_VARIANT_SMALL_LATENCY)
+#define ICS_PROFILE 0
+#define ICS_REGION_RESERVE 1
+#elif defined(ICS_VARIANT_LARGE_THROUGHPUT)
+#define BLOCK_GRANULE 64
+#define MIN_BLOCK_SIZE 64
+#define ICS_PROFILE 0
+#define ICS_HUGEPAGES 1
+#elif defined(ICS_VARIANT_HARDENED)
+#define ICS_HARDENED 1
+#elif defined(ICS_VARIANT_THREAD_SAFE)
+#define ICS_THREAD_SAFE 1
+#define ICS_PROFILE 0
+#define ICS_REGION_RESERVE 1
+#elif defined(ICS_VARIANT_NUMA)
+#define ICS_THREAD_SAFE 1
+#define ICS_NUMA 1
+#define ICS_PROFILE 0
+#define ICS_REGION_RESERVE 1
+#elif defined(ICS_VARIANT_PERSISTENT)
+#define ICS_PERSISTENT 1
+#define ICS_REGION_RESERVE 1
+#elif defined(ICS_VARIANT_COMPACT)
+#define ICS_COMPACT_LINKS 1
+#define ALIGNMENT 8
+#define BLOCK_GRANULE 8
+#define MIN_BLOCK_SIZE 24
+#elif defined(ICS_VARIANT_ADAPTIVE)
+#define ICS_SIZE_CLASSES 32
+#endif
+
+
+#ifndef REQUEST_SIZE_BITS
+#define REQUEST_SIZE_BITS 16
+#endif
+#ifndef HID_SIZE_BITS
+#define HID_SIZE_BITS 32
+#endif
+#ifndef BLOCK_SIZE_BITS
+#define BLOCK_SIZE_BITS 16
+#endif
+#ifndef FID_SIZE_BITS
+#define FID_SIZE_BITS 32
+#endif
+
+#ifndef ALIGNMENT
+#define ALIGNMENT 16
+#endif
+#define ICS_CACHE_LINE 64
+
+#ifndef ICS_COMPACT_LINKS
+#define ICS_COMPACT_LINKS 0
+#endif
+
+#ifndef ICS_CACHELINE_PAD
+#define ICS_CACHELINE_PAD 0
+#endif
+
+#if ICS_CACHELINE_PAD
+#ifndef BLOCK_GRANULE
+#define BLOCK_GRANULE ICS_CACHE_LINE
+#endif
+#ifndef MIN_BLOCK_SIZE
+#define MIN_BLOCK_SIZE (2 * ICS_CACHE_LINE)
+#endif
+#endif
+
+#ifndef BLOCK_GRANULE
+#define BLOCK_GRANULE ALIGNMENT
+#endif
+#ifndef MIN_BLOCK_SIZE
+#define MIN_BLOCK_SIZE 32
+#endif
+
+#define MAX_PAGES 5
+#define PAGE_SIZE 4096
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+#ifndef ICS_HUGEPAGES
+#define ICS_HUGEPAGES 0
+#endif
+#ifndef ICS_REGION_RESERVE
+#define ICS_REGION_RESERVE ICS_HUGEPAGES
+#endif
+#ifndef ICS_RESERVE_SIZE
+#define ICS_RESERVE_SIZE (64UL << 20)
+#endif
+
+#ifndef ICS_COMMIT_CHUNK
+#define ICS_COMMIT_CHUNK (ICS_HUGEPAGES ? HUGE_PAGE_SIZE : (64UL << 10))
+#endif
+#ifndef ICS_GROWTH_FACTOR
+#define ICS_GROWTH_FACTOR 2
+#endif
+
+#define ICS_ENGINE_NEXTFIT 0
+#define ICS_ENGINE_TLSF 1
+#define ICS_ENGINE_BUDDY 2
+
+#ifndef ICS_ENGINE
+#define ICS_ENGINE ICS_ENGINE_NEXTFIT
+#endif
+#ifndef ICS_BUDDY_MAX_ORDER
+#define ICS_BUDDY_MAX_ORDER (ICS_REGION_RESERVE ? 20 : 12)
+#endif
+
+#ifndef ICS_THREAD_SAFE
+#define ICS_THREAD_SAFE 0
+#endif
+#ifndef ICS_MAX_HEAPS
+#define ICS_MAX_HEAPS 64
+#endif
+#ifndef ICS_NUMA
+#define ICS_NUMA 0
+#endif
+#ifndef ICS_PERSISTENT
+#define ICS_PERSISTENT 0
+#endif
+
+#ifndef ICS_SIZE_CLASSES
+#define ICS_SIZE_CLASSES 0
+#endif
+#ifndef ICS_CLASS_WARMUP
+#define ICS_CLASS_WARMUP 65536
+#endif
+#ifndef ICS_CLASS_MAX_BLOCK
+#define ICS_CLASS_MAX_BLOCK 1024
+#endif
+
+#ifndef ICS_PROFILE
+#define ICS_PROFILE 1
+#endif
+#ifndef ICS_HARDENED
+#define ICS_HARDENED 0
+#endif
+
+#define ICS_POISON_BYTE 0xdf
+
+
+#if (ALIGNMENT != 8 && ALIGNMENT != 16) || BLOCK_GRANULE < ALIGNMENT || (BLOCK_GRANULE & (BLOCK_GRANULE - 1))
+#error "ALIGNMENT must be 8 or 16 and BLOCK_GRANULE a power of two no smaller than it"
+#endif
+#if MIN_BLOCK_SIZE < (ICS_COMPACT_LINKS ? 24 : 32) || MIN_BLOCK_SIZE % BLOCK_GRANULE
+#error "MIN_BLOCK_SIZE must hold a free header and footer and be a multiple of BLOCK_GRANULE"
+#endif
+#if ICS_COMPACT_LINKS && (ICS_ENGINE == ICS_ENGINE_BUDDY || (ICS_REGION_RESERVE && ICS_RESERVE_SIZE > (1UL << 32)))
+#error "ICS_COMPACT_LINKS needs a boundary-tag engine and a heap below 4 GiB"
+#endif
+#if ICS_HUGEPAGES && !ICS_REGION_RESERVE
+#error "ICS_HUGEPAGES needs ICS_REGION_RESERVE"
+#endif
+#if ICS_COMMIT_CHUNK % (ICS_HUGEPAGES ? HUGE_PAGE_SIZE : PAGE_SIZE)
+#error "ICS_COMMIT_CHUNK must be a multiple of the page size in use"
+#endif
+#if ICS_REGION_RESERVE && ICS_RESERVE_SIZE % ICS_COMMIT_CHUNK
+#error "ICS_RESERVE_SIZE must be a multiple of ICS_COMMIT_CHUNK"
+#endif
+#if ICS_ENGINE == ICS_ENGINE_BUDDY && ICS_HARDENED
+#error "the buddy engine has no boundary tags for ICS_HARDENED to check"
+#endif
+#if ICS_ENGINE == ICS_ENGINE_BUDDY && ((1UL << ICS_BUDDY_MAX_ORDER) % PAGE_SIZE || (ICS_REGION_RESERVE && ICS_RESERVE_SIZE % (1UL << ICS_BUDDY_MAX_ORDER)))
+#error "ICS_BUDDY_MAX_ORDER must give whole pages that tile the reservation"
+#endif
+#if ICS_THREAD_SAFE && (!ICS_REGION_RESERVE || ICS_PROFILE || ICS_ENGINE == ICS_ENGINE_BUDDY)
+#error "ICS_THREAD_SAFE needs ICS_REGION_RESERVE, ICS_PROFILE 0 and a boundary-tag engine"
+#endif
+#if ICS_CACHELINE_PAD && (BLOCK_GRANULE != ICS_CACHE_LINE || ICS_ENGINE == ICS_ENGINE_BUDDY)
+#error "ICS_CACHELINE_PAD needs a boundary-tag engine with BLOCK_GRANULE equal to ICS_CACHE_LINE"
+#endif
+#if ICS_PERSISTENT && (!ICS_REGION_RESERVE || ICS_HUGEPAGES || ICS_THREAD_SAFE || ICS_ENGINE == ICS_ENGINE_BUDDY)
+#error "ICS_PERSISTENT needs ICS_REGION_RESERVE without ICS_HUGEPAGES, one heap and a boundary-tag engine"
+#endif
+#if ICS_SIZE_CLASSES && (ICS_ENGINE == ICS_ENGINE_BUDDY || ICS_CLASS_WARMUP < 1 || ICS_CLASS_MAX_BLOCK % BLOCK_GRANULE || ICS_CLASS_MAX_BLOCK >= (1UL << BLOCK_SIZE_BITS))
+#error "ICS_SIZE_CLASSES needs a boundary-tag engine and ICS_CLASS_MAX_BLOCK a block size multiple of BLOCK_GRANULE"
+#endif
+#if ICS_NUMA && !ICS_THREAD_SAFE
+#error "ICS_NUMA needs the per-thread heaps of ICS_THREAD_SAFE"
+#endif
+#if REQUEST_SIZE_BITS + HID_SIZE_BITS + BLOCK_SIZE_BITS != 64 || REQUEST_SIZE_BITS + FID_SIZE_BITS + BLOCK_SIZE_BITS != 64
+#error "header and footer bitfields must add up to 64 bits"
+#endif
+
+
+#endif
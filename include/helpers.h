@@ -3,26 +3,297 @@
 
 
 #include "icsmm.h"
+#if ICS_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+
+#define HEADER_MAGIC 0x0badbee5UL
+#define FOOTER_MAGIC 0xfaceba5eUL
+
+#define PROLOGUE_SIZE sizeof(ics_header)
+#define EPILOGUE_SIZE sizeof(ics_footer)
+#define GET_EPILOGUE_ADDR(heapBrk) ( (ics_footer*)((char*)(heapBrk) - EPILOGUE_SIZE) )
+
+#define HEADER_SIZE sizeof(ics_header)
+#define FOOTER_SIZE sizeof(ics_footer)
+#define ROUND_UP(size, granule) ( ((size) + (granule) - 1) & ~((size_t)(granule) - 1) )
+#define MAX_BLOCK_SIZE ( (1UL << BLOCK_SIZE_BITS) - BLOCK_GRANULE )
+
+#if ICS_CACHELINE_PAD
+// Payloads start on a line; the last line of a block holds its footer and the next header only.
+#define HEAP_START_PAD ( ICS_CACHE_LINE - PROLOGUE_SIZE - HEADER_SIZE )
+#define CALC_ACTUAL_BLOCK_SIZE(size) ( ROUND_UP((size), ICS_CACHE_LINE) + ICS_CACHE_LINE )
+#define GET_USABLE_SIZE(blockSize) ( (blockSize) - ICS_CACHE_LINE )
+#else
+#define HEAP_START_PAD 0
+#define CALC_ACTUAL_BLOCK_SIZE(size) ( (ROUND_UP((size) + HEADER_SIZE + FOOTER_SIZE, BLOCK_GRANULE) < MIN_BLOCK_SIZE) ? MIN_BLOCK_SIZE : ROUND_UP((size) + HEADER_SIZE + FOOTER_SIZE, BLOCK_GRANULE) )
+#define GET_USABLE_SIZE(blockSize) ( (blockSize) - HEADER_SIZE - FOOTER_SIZE )
+#endif
+#define MAX_REQUEST_SIZE GET_USABLE_SIZE(MAX_BLOCK_SIZE)
+
+#define GET_SIZE_CLASS(blockSize) ( (blockSize) / BLOCK_GRANULE )
+
+#define SET_ALLOCATED_FLAG(blockSize) (blockSize | 0x1)
+#define CLEAR_ALLOCATED_FLAG(blockSize) (blockSize & ~0x1)
+#define IS_ALLOCATED(blockSize, requestedSize) ( ((blockSize & 0x1) == 1) && (requestedSize != 0) )
+
+#define GET_CURR_HEADER(currPlayload) ( (ics_free_header*)((char*)(currPlayload) - HEADER_SIZE) )
+#define GET_CURR_PLAYLOAD(currHeader) ( (void*)((char*)(currHeader) + HEADER_SIZE) )
+#define GET_CURR_FOOTER(currHeader, currBlockSize) ( (ics_footer*)((char*)(currHeader) + currBlockSize - FOOTER_SIZE) )
+
+#if ICS_COMPACT_LINKS
+// Links are offsets from the prologue; 0, the prologue itself, is never a free block and stands for NULL.
+#define NEXT_FREE(block) ( (ics_free_header*)((block)->next ? (char*)prologue + (block)->next : NULL) )
+#define PREV_FREE(block) ( (ics_free_header*)((block)->prev ? (char*)prologue + (block)->prev : NULL) )
+#define SET_NEXT_FREE(block, target) ( (block)->next = (target) ? (uint32_t)((char*)(target) - (char*)prologue) : 0 )
+#define SET_PREV_FREE(block, target) ( (block)->prev = (target) ? (uint32_t)((char*)(target) - (char*)prologue) : 0 )
+#else
+#define NEXT_FREE(block) ( (block)->next )
+#define PREV_FREE(block) ( (block)->prev )
+#define SET_NEXT_FREE(block, target) ( (block)->next = (target) )
+#define SET_PREV_FREE(block, target) ( (block)->prev = (target) )
+#endif
+// Blocks queued for another heap are linked through a full pointer at the start of the payload.
+#define REMOTE_NEXT(block) ( *(ics_free_header**)GET_CURR_PLAYLOAD(block) )
+
+#define GET_NEXT_HEADER(currHeader, currBlockSize) ( (ics_free_header*)((char*)(currHeader) + currBlockSize) )
+#define GET_NEXT_FOOTER(nextHeader, nextBlockSize) ( (ics_footer*)((char*)(nextHeader) + nextBlockSize - FOOTER_SIZE) )
+
+#define GET_PREV_HEADER(prevFooter, prevBlockSize) ( (ics_free_header*)((char*)(prevFooter) - prevBlockSize + HEADER_SIZE) )
+#define GET_PREV_FOOTER(currHeader) ( (ics_footer*)((char*)(currHeader) - FOOTER_SIZE) )
+
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_SHIFT (TLSF_SL_LOG2 + 4)
+#define TLSF_FL_COUNT (BLOCK_SIZE_BITS - TLSF_FL_SHIFT + 1)
+#define TLSF_SMALL_BLOCK (1UL << TLSF_FL_SHIFT)
+#define TLSF_FLS(size) ( 63 - __builtin_clzl(size) )
+
+#define BUDDY_MIN_ORDER 4
+#define BUDDY_MIN_SIZE (1UL << BUDDY_MIN_ORDER)
+#define BUDDY_TOP_SIZE (1UL << ICS_BUDDY_MAX_ORDER)
+#define BUDDY_ORDERS (ICS_BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1)
+#define BUDDY_SLOT(order) ( (order) - BUDDY_MIN_ORDER )
+#if ICS_REGION_RESERVE
+#define BUDDY_ARENA_MAX ICS_RESERVE_SIZE
+#else
+#define BUDDY_ARENA_MAX (MAX_PAGES * PAGE_SIZE)
+#endif
+#define BUDDY_ORDER_WORDS(order) ( ((BUDDY_ARENA_MAX >> (order)) + 63) >> 6 )
+#define BUDDY_MAP_WORDS ( (BUDDY_ARENA_MAX >> (BUDDY_MIN_ORDER + 5)) + BUDDY_ORDERS )
+
+// Largest growth factor ics_mem_tune accepts; a larger one commits the whole reservation after two steps.
+#define MAX_GROWTH_FACTOR 16
+
+#if ICS_THREAD_SAFE
+#define ICS_HEAP_LOCAL __thread
+#define pagesCount heapPagesCount
+#define prologue heapPrologue
+#else
+#define ICS_HEAP_LOCAL
+#endif
+#if ICS_THREAD_SAFE || ICS_COMPACT_LINKS
+// lib/icsutil.o walks freelist_head through raw pointers, so the allocator keeps its list under other names.
+#define freelist_head heapFreelistHead
+#define freelist_next heapFreelistNext
+#endif
+
+#define ICS_PERSIST_MAGIC 0x50534349UL
+#define ICS_PERSIST_VERSION 1
+
+#define ICS_MPOL_PREFERRED 1
+#define ICS_NUMA_MAX_NODES 64
+#define ICS_NUMA_NODE_REFRESH 64
+
+#define ICS_PROFILE_SLOTS 512
+#define ICS_PROFILE_MAX_DEPTH 24
+#define ICS_PROFILE_SKIP_FRAMES 2
+// Largest sampling interval: nextSampleDistance draws from twice the interval, which must fit an int64_t.
+#define MAX_PROFILE_INTERVAL ( (size_t)INT64_MAX >> 1 )
+#define ICS_SNAPSHOT_BATCH 64
+#define ICS_GROWABLE_SLOTS 8
+#define CLASS_SLOTS (ICS_CLASS_MAX_BLOCK / BLOCK_GRANULE + 1)
+#define PROFILE_HASH(ptr) ( (((uintptr_t)(ptr) >> 4) * 0x9e3779b97f4a7c15ULL >> 32) & (ICS_PROFILE_SLOTS - 1) )
+
+
+typedef struct ics_profile_sample {
+    void *ptr;
+    size_t size;
+    unsigned int depth;
+    void *stack[ICS_PROFILE_MAX_DEPTH];
+} ics_profile_sample;
+
+
+/*
+ * First page of a heap file. The layout fields must match the build that
+ * attaches to it; pages and root are kept current while the heap is in use.
+ * root is an offset from the start of the heap plus one, 0 meaning none.
+ */
+typedef struct ics_persist_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t alignment;
+    uint32_t block_granule;
+    uint32_t min_block_size;
+    uint32_t heap_start_pad;
+    uint32_t engine;
+    uint64_t reserve_size;
+    uint64_t pages;
+    uint64_t root;
+} ics_persist_header;
+
+
+#if ICS_THREAD_SAFE
+/*
+ * The thread-local variables that describe a heap, kept in its entry while no
+ * thread owns it.
+ */
+typedef struct ics_heap_state {
+    ics_free_header *freelistHead;
+    ics_free_header *freelistNext;
+    ics_header *prologueHeader;
+    unsigned int pages;
+    int8_t softLimitCrossed;
+    char *regionBase;
+    char *regionBrk;
+    char *regionCommitted;
+    char *regionLimit;
+    size_t commitChunk;
+    int8_t hugePages;
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    uint32_t flBitmap;
+    uint32_t slBitmap[TLSF_FL_COUNT];
+    ics_free_header *tlsfBlocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+#endif
+} ics_heap_state;
+
+/*
+ * One entry per thread heap. base and brk bound the heap for findHeap() in
+ * other threads, remoteFrees is the owner's MPSC list of blocks freed by them.
+ * With ICS_NUMA, node is where the heap is bound and the counters back
+ * ics_get_numa_stats. orphaned is set once the owner has exited and its
+ * variables are saved in state, until another thread adopts the heap.
+ */
+typedef struct ics_heap {
+    char *base;
+    char *brk;
+#if ICS_NUMA
+    unsigned int node;
+    size_t remoteNodeAllocs;
+#endif
+    // Written by other threads, so kept off the line every findHeap() reads.
+    ics_free_header *remoteFrees __attribute__((aligned(ICS_CACHE_LINE)));
+#if ICS_NUMA
+    size_t remoteFreeCount;
+    size_t remoteNodeFrees;
+#endif
+    // Held by the owner while it changes the heap, and by fork() to quiesce it.
+    pthread_mutex_t lock __attribute__((aligned(ICS_CACHE_LINE)));
+    int8_t orphaned;
+    ics_heap_state state;
+} __attribute__((aligned(ICS_CACHE_LINE))) ics_heap;
+#endif
+
+
+extern int64_t profileCountdown;
+extern unsigned int profileLive;
+
+#if ICS_PERSISTENT
+extern ics_persist_header *persistHeader;
+#endif
+
+extern size_t heapSoftLimit;
+extern size_t heapHardLimit;
+extern ICS_HEAP_LOCAL int8_t softLimitCrossed;
+
+#if ICS_THREAD_SAFE || ICS_COMPACT_LINKS
+extern ICS_HEAP_LOCAL ics_free_header *freelist_head;
+extern ICS_HEAP_LOCAL ics_free_header *freelist_next;
+#endif
+#if ICS_THREAD_SAFE
+extern ICS_HEAP_LOCAL unsigned int pagesCount;
+extern ICS_HEAP_LOCAL ics_header *prologue;
+extern ICS_HEAP_LOCAL ics_heap *localHeap;
+extern ICS_HEAP_LOCAL unsigned int heapLockDepth;
+extern pthread_mutex_t heapRegistryLock;
+extern ics_heap heaps[ICS_MAX_HEAPS];
+extern unsigned int heapCount;
+#endif
 
 
 int8_t initHeap();
 
+void* getHeapBrk();
+
+void* incHeapBrk(size_t pages);
+
+size_t heapPagesLeft();
+
+int8_t notifyPressure(int level, size_t requestedSize);
+
+#if ICS_SIZE_CLASSES
+size_t classBlockSize(size_t blockSize);
+
+size_t findSizeClass(size_t blockSize);
+
+void deriveSizeClasses();
+
+void setSizeClasses(const uint32_t *sizes, unsigned int count);
+#endif
+
+#if ICS_REGION_RESERVE
+int8_t reserveRegion();
+
+int8_t commitRegion();
+#endif
+
+#if ICS_PERSISTENT
+char* mapRegionFile(int fd, char *base, size_t *reserve, size_t used, size_t committed);
+
+int8_t unmapRegionFile();
+
+int openHeapFile(const char *path, size_t *reserve, size_t *used, size_t *committed);
+
+int8_t attachHeap();
+#endif
+
 ics_footer* initFooter(ics_free_header *block);
 
 ics_free_header* findNextFit(size_t requestedSize);
 
-ics_free_header* extendHeap(size_t requestedSize);
+ics_free_header* findGrowableFit(size_t blockSize);
 
-ics_free_header* getFreelistTail();
+ics_free_header* extendHeap(size_t requestedSize);
 
 void splitBlock(ics_free_header *targetBlock, size_t blockSize);
 
+void* placeBlock(ics_free_header *targetBlock, size_t blockSize, size_t requestedSize);
+
+void* placeGrowableBlock(ics_free_header *targetBlock, size_t blockSize, size_t requestedSize);
+
+void rememberGrowableBlock(ics_free_header *block);
+
+int8_t isGrowableBlock(ics_free_header *block, int8_t forget);
+
 void* allocateBlock(ics_free_header *targetBlock, size_t blockSize, size_t requestedSize);
 
+int8_t growBlock(ics_free_header *block, size_t blockSize, size_t requestedSize);
+
+void unlinkFreeBlock(ics_free_header *block);
+
 int8_t isBlockValid(ics_free_header *block, ics_footer *footer);
 
+int8_t hasValidTags(ics_free_header *block, ics_footer *footer);
+
+#if ICS_HARDENED
+void checkFreeBlock(ics_free_header *block);
+#endif
+
 int8_t isInHeap(char *block);
 
+int8_t releaseBlock(ics_free_header *block, ics_footer *footer);
+
 int8_t coalesceBlocks(ics_free_header **currBlock, ics_footer **currFooter);
 
 void coalescePrevBlock(ics_free_header **currBlock, ics_free_header *prevBlock);
@@ -35,5 +306,106 @@ int8_t checkAdjBlockAvailability(ics_free_header *block, ics_footer *footer);
 
 void insertInOrderToFreelist(ics_free_header *block);
 
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+void tlsfMappingInsert(size_t blockSize, unsigned int *fl, unsigned int *sl);
+
+ics_free_header* tlsfFindFit(size_t blockSize);
+
+ics_free_header* tlsfFindLargest();
+
+void tlsfInsert(ics_free_header *block);
+
+void tlsfRemove(ics_free_header *block);
+
+void tlsfClear();
+#endif
+
+#if ICS_THREAD_SAFE
+ics_heap* registerHeap(char *base, size_t size);
+
+ics_heap* findHeap(char *block);
+
+ics_heap* findBlockOwner(ics_free_header *block);
+
+int freeRemoteBlock(ics_free_header *block);
+
+void drainRemoteFrees();
+
+void orphanHeap(void *heap);
+
+int8_t adoptHeap();
+
+void saveHeapState(ics_heap_state *state);
+
+void loadHeapState(const ics_heap_state *state);
+
+void saveRegionState(ics_heap_state *state);
+
+void loadRegionState(const ics_heap_state *state);
+
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+void saveTlsfState(ics_heap_state *state);
+
+void loadTlsfState(const ics_heap_state *state);
+#endif
+
+void lockHeap();
+
+void unlockHeap();
+
+void prepareFork();
+
+void resumeForkParent();
+
+void resumeForkChild();
+#else
+#define lockHeap() ((void)0)
+#define unlockHeap() ((void)0)
+#endif
+
+#if ICS_NUMA
+unsigned int numaNodeCount();
+
+unsigned int currentNode();
+
+void bindRegion(char *base, size_t size, unsigned int node);
+
+void checkHeapNode();
+#endif
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+void* buddyAllocate(size_t size);
+
+int buddyBlockOrder(void *ptr);
+
+void buddyRelease(void *ptr, unsigned int order);
+
+int8_t growBuddyArena();
+
+size_t findFreeBuddy(unsigned int order);
+
+int8_t testBuddyBit(unsigned int order, size_t index);
+
+void setBuddyBit(unsigned int order, size_t index);
+
+void clearBuddyBit(unsigned int order, size_t index);
+#endif
+
+int64_t nextSampleDistance();
+
+void profileSample(void *ptr, size_t size);
+
+void profileRemove(void *ptr);
+
+ics_profile_sample* findProfileSlot(void *ptr, int8_t forInsert);
+
+void writePprofSample(int fd, ics_profile_sample *sample);
+
+void writeCollapsedSample(int fd, ics_profile_sample *sample);
+
+void writeMappedLibraries(int fd);
+
+int8_t writeSnapshotBytes(int fd, const void *buffer, size_t length);
+
 
 #endif
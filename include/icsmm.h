@@ -7,43 +7,33 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "config.h"
 
-#define HEADER_MAGIC 0x0badbee5UL
-#define FOOTER_MAGIC 0xfaceba5eUL
 
-#define REQUEST_SIZE_BITS 16
-#define HID_SIZE_BITS 32
-#define BLOCK_SIZE_BITS 16
-#define FID_SIZE_BITS 32
+#define ICS_PROFILE_PPROF 0
+#define ICS_PROFILE_COLLAPSED 1
 
-#define ALIGNMENT 16
-#define MIN_BLOCK_SIZE 32
+#define ICS_GROWABLE 0x1
 
-#define MAX_PAGES 5
-#define PAGE_SIZE 4096
+#define ICS_PRESSURE_SOFT 1
+#define ICS_PRESSURE_HARD 2
 
-#define PROLOGUE_SIZE sizeof(ics_header)
-#define EPILOGUE_SIZE sizeof(ics_footer)
-#define GET_EPILOGUE_ADDR(newPageStart) ( (ics_footer*)(newPageStart + PAGE_SIZE - EPILOGUE_SIZE) )
+#define ICS_SNAPSHOT_MAGIC 0x53534349UL
+#define ICS_SNAPSHOT_VERSION 1
 
-#define HEADER_SIZE sizeof(ics_header)
-#define FOOTER_SIZE sizeof(ics_footer)
-#define CALC_ACTUAL_BLOCK_SIZE(size) ((size < ALIGNMENT) ? (ALIGNMENT << 1) : (((size + HEADER_SIZE + FOOTER_SIZE + ALIGNMENT - 1) >> 4) << 4))
+#define ICS_SIZE_CLASS_MAGIC 0x43534349UL
+#define ICS_SIZE_CLASS_VERSION 1
 
-#define SET_ALLOCATED_FLAG(blockSize) (blockSize | 0x1)
-#define CLEAR_ALLOCATED_FLAG(blockSize) (blockSize & ~0x1)
-#define IS_ALLOCATED(blockSize, requestedSize) ( ((blockSize & 0x1) == 1) && (requestedSize != 0) )
 
-#define GET_CURR_HEADER(currPlayload) ( (ics_free_header*)((char*)(currPlayload) - HEADER_SIZE) )
-#define GET_CURR_PLAYLOAD(currHeader) ( (void*)((char*)(currHeader) + HEADER_SIZE) )
-#define GET_CURR_FOOTER(currHeader, currBlockSize) ( (ics_footer*)((char*)(currHeader) + currBlockSize - FOOTER_SIZE) )
-
-#define GET_NEXT_HEADER(currHeader, currBlockSize) ( (ics_free_header*)((char*)(currHeader) + currBlockSize) )
-#define GET_NEXT_FOOTER(nextHeader, nextBlockSize) ( (ics_footer*)((char*)(nextHeader) + nextBlockSize - FOOTER_SIZE) )
-
-#define GET_PREV_HEADER(prevFooter, prevBlockSize) ( (ics_free_header*)((char*)(prevFooter) - prevBlockSize + HEADER_SIZE) )
-#define GET_PREV_FOOTER(currHeader) ( (ics_footer*)((char*)(currHeader) - FOOTER_SIZE) )
+typedef int (*ics_pressure_handler)(int level, size_t heap_bytes, size_t request, void *arg);
 
+typedef struct ics_numa_stats {
+    unsigned int nodes;
+    unsigned int heaps;
+    size_t remote_frees;
+    size_t remote_node_frees;
+    size_t remote_node_allocs;
+} ics_numa_stats;
 
 typedef struct __attribute__((__packed__)) {
     uint64_t block_size: BLOCK_SIZE_BITS;
@@ -53,8 +43,13 @@ typedef struct __attribute__((__packed__)) {
 
 typedef struct __attribute__((__packed__)) ics_free_header {
     ics_header header;
+#if ICS_COMPACT_LINKS
+    uint32_t next;
+    uint32_t prev;
+#else
     struct ics_free_header *next;
     struct ics_free_header *prev;
+#endif
 } ics_free_header;
 
 typedef struct __attribute__((__packed__)) ics_footer {
@@ -63,7 +58,35 @@ typedef struct __attribute__((__packed__)) ics_footer {
     uint64_t requested_size: REQUEST_SIZE_BITS;
 } ics_footer;
 
-
+typedef struct __attribute__((__packed__)) ics_snapshot_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t alignment;
+    uint32_t heap_size;
+    uint32_t block_count;
+} ics_snapshot_header;
+
+typedef struct __attribute__((__packed__)) ics_snapshot_block {
+    uint32_t offset;
+    uint32_t block_size;
+    uint16_t requested_size;
+    uint16_t size_class;
+    uint8_t allocated;
+} ics_snapshot_block;
+
+typedef struct __attribute__((__packed__)) ics_size_class_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t block_granule;
+    uint32_t count;
+} ics_size_class_header;
+
+
+/*
+ * The heap as lib/icsutil.o and the tests see it. With ICS_THREAD_SAFE every
+ * thread has a heap of its own and these stay empty (NULL and 0); so does the
+ * free list with ICS_COMPACT_LINKS.
+ */
 extern ics_free_header *freelist_head;
 extern ics_free_header *freelist_next;
 extern unsigned int pagesCount;
@@ -72,14 +95,38 @@ extern ics_header *prologue;
 
 void *ics_malloc(size_t size);
 
+void *ics_malloc_flags(size_t size, unsigned int flags);
+
 void *ics_realloc(void *ptr, size_t size);
 
 int ics_free(void *ptr);
 
+size_t ics_usable_size(void *ptr);
+
 void ics_mem_init();
 
 void ics_mem_fini();
 
+int ics_mem_tune(size_t reserve_size, unsigned int growth_factor);
+
+void ics_set_pressure_handler(ics_pressure_handler handler, void *arg);
+
+int ics_set_heap_limits(size_t soft_limit, size_t hard_limit);
+
+int ics_get_numa_stats(ics_numa_stats *stats);
+
+int ics_mem_attach(const char *path, void *base);
+
+int ics_mem_detach();
+
+int ics_set_root(void *ptr);
+
+void *ics_get_root();
+
+int ics_size_classes_export(int fd);
+
+int ics_size_classes_load(int fd);
+
 void *ics_get_brk();
 
 void *ics_inc_brk();
@@ -96,5 +143,11 @@ int ics_header_print_compact(void *header);
 
 int ics_payload_print_compact(void *payload);
 
+void ics_profile_set_interval(size_t bytes);
+
+int ics_profile_dump(int fd, int format);
+
+int ics_heap_snapshot(int fd);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include "helpers.h"
+#include "debug.h"
+
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+/*
+ * Binary buddy system over the pages handed out by incHeapBrk(). The arena
+ * grows by whole BUDDY_TOP_SIZE blocks; a block of order k starts at an offset
+ * that is a multiple of 2^k from buddyBase, so its buddy is found by flipping
+ * bit k of the offset. Blocks carry no header or footer: bit i of the order k
+ * bitmap says whether block i of that order is free, and blockOrders records
+ * order + 1 for the first BUDDY_MIN_SIZE unit of every allocated block.
+ */
+static char *buddyBase = NULL;
+static size_t buddyTop = 0;
+static uint64_t freeMaps[BUDDY_MAP_WORDS];
+static size_t mapOffsets[BUDDY_ORDERS];
+static size_t freeCounts[BUDDY_ORDERS];
+static size_t searchHints[BUDDY_ORDERS];
+static uint8_t blockOrders[BUDDY_ARENA_MAX >> BUDDY_MIN_ORDER];
+
+
+void*
+buddyAllocate(size_t size)
+{
+    unsigned int order = BUDDY_MIN_ORDER, k = 0;
+    size_t index = 0;
+
+    if(size > BUDDY_TOP_SIZE) return NULL;
+    while((1UL << order) < size) ++order;
+
+    for(k = order; k <= ICS_BUDDY_MAX_ORDER && !freeCounts[BUDDY_SLOT(k)]; ++k);
+
+    if(k > ICS_BUDDY_MAX_ORDER)
+    {
+        if(growBuddyArena() == -1) return NULL;
+        k = ICS_BUDDY_MAX_ORDER;
+    }
+
+    index = findFreeBuddy(k);
+    clearBuddyBit(k, index);
+
+    // Split down to the requested order, keeping the upper half of every split free.
+    while(k > order)
+    {
+        --k;
+        index <<= 1;
+        setBuddyBit(k, index + 1);
+    }
+
+    blockOrders[(index << order) >> BUDDY_MIN_ORDER] = order + 1;
+
+    return buddyBase + (index << order);
+}
+
+int
+buddyBlockOrder(void *ptr)
+{
+    size_t offset = (char*)ptr - buddyBase;
+    unsigned int order = 0;
+
+    if( !buddyBase ||
+        (char*)ptr < buddyBase ||
+        offset >= buddyTop ||
+        offset & (BUDDY_MIN_SIZE - 1) ||
+        !( order = blockOrders[offset >> BUDDY_MIN_ORDER] ) ||
+        offset & ((1UL << (order - 1)) - 1) )
+    {
+        return -1;
+    }
+
+    return order - 1;
+}
+
+void
+buddyRelease(void *ptr, unsigned int order)
+{
+    size_t offset = (char*)ptr - buddyBase, index = offset >> order;
+
+    blockOrders[offset >> BUDDY_MIN_ORDER] = 0;
+
+    while(order < ICS_BUDDY_MAX_ORDER && testBuddyBit(order, index ^ 1))
+    {
+        clearBuddyBit(order, index ^ 1);
+        index >>= 1;
+        ++order;
+    }
+
+    setBuddyBit(order, index);
+}
+
+int8_t
+growBuddyArena()
+{
+    unsigned int k = 0;
+    char *topBlock = NULL;
+
+    if(buddyTop + BUDDY_TOP_SIZE > BUDDY_ARENA_MAX) return -1;
+    if( ( topBlock = incHeapBrk(BUDDY_TOP_SIZE / PAGE_SIZE) ) == (void*)-1 ) return -1;
+
+    if(!buddyBase)
+    {
+        buddyBase = topBlock;
+        for(k = BUDDY_MIN_ORDER; k < ICS_BUDDY_MAX_ORDER; ++k)
+        {
+            mapOffsets[BUDDY_SLOT(k + 1)] = mapOffsets[BUDDY_SLOT(k)] + BUDDY_ORDER_WORDS(k);
+        }
+    }
+
+    setBuddyBit(ICS_BUDDY_MAX_ORDER, buddyTop >> ICS_BUDDY_MAX_ORDER);
+    buddyTop += BUDDY_TOP_SIZE;
+
+    return 1;
+}
+
+size_t
+findFreeBuddy(unsigned int order)
+{
+    uint64_t *map = freeMaps + mapOffsets[BUDDY_SLOT(order)];
+    size_t word = searchHints[BUDDY_SLOT(order)];
+
+    while(!map[word]) ++word;
+    searchHints[BUDDY_SLOT(order)] = word;
+
+    return (word << 6) + __builtin_ctzll(map[word]);
+}
+
+int8_t
+testBuddyBit(unsigned int order, size_t index)
+{
+    return (freeMaps[mapOffsets[BUDDY_SLOT(order)] + (index >> 6)] >> (index & 63)) & 1;
+}
+
+void
+setBuddyBit(unsigned int order, size_t index)
+{
+    freeMaps[mapOffsets[BUDDY_SLOT(order)] + (index >> 6)] |= 1ULL << (index & 63);
+    ++freeCounts[BUDDY_SLOT(order)];
+    if((index >> 6) < searchHints[BUDDY_SLOT(order)]) searchHints[BUDDY_SLOT(order)] = index >> 6;
+}
+
+void
+clearBuddyBit(unsigned int order, size_t index)
+{
+    freeMaps[mapOffsets[BUDDY_SLOT(order)] + (index >> 6)] &= ~(1ULL << (index & 63));
+    --freeCounts[BUDDY_SLOT(order)];
+}
+#endif
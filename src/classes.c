@@ -0,0 +1,237 @@
+#include "helpers.h"
+#include "debug.h"
+#include <unistd.h>
+
+
+#if ICS_SIZE_CLASSES
+/*
+ * Size classes learned from the requests of the run. Until classesReady is
+ * set, ics_malloc counts every block size up to ICS_CLASS_MAX_BLOCK in
+ * classHistogram, indexed by size / BLOCK_GRANULE. After ICS_CLASS_WARMUP
+ * requests the thread that takes the last one derives the classes and fills
+ * classBlock with the class each index rounds up to, 0 above the largest class.
+ * The table is published once and never changes afterwards, so the lookup
+ * needs no lock. Plain rounding already is the tightest fit, so the classes
+ * trade internal fragmentation for fewer distinct block sizes; the derivation
+ * only keeps that cost as low as ICS_SIZE_CLASSES allows.
+ */
+static uint32_t classHistogram[CLASS_SLOTS];
+static uint16_t classBlock[CLASS_SLOTS];
+static uint32_t classSizes[ICS_SIZE_CLASSES];
+static unsigned int classCount = 0;
+static long classWarmup = ICS_CLASS_WARMUP;
+static int8_t classesReady = 0;
+
+// Scratch space of deriveSizeClasses, too large for the stack of a small thread.
+static uint64_t classCost[ICS_SIZE_CLASSES + 1][CLASS_SLOTS + 1];
+static uint16_t classCut[ICS_SIZE_CLASSES + 1][CLASS_SLOTS + 1];
+#endif
+
+
+/*
+ * Writes the size classes in use to fd: one ics_size_class_header followed by
+ * the block size of every class as a uint32_t, in ascending order. The table
+ * can be given to ics_size_classes_load() in a later run.
+ *
+ * @param fd Open file descriptor the table is written to.
+ *
+ * @return 0 upon success, -1 if error and set errno accordingly.
+ *
+ * If fd is invalid or the allocator was built without ICS_SIZE_CLASSES, errno
+ * is set to EINVAL. If the classes are not derived yet, errno is set to EAGAIN.
+ * If writing fails, errno is left as set by write(2).
+ */
+int
+ics_size_classes_export(int fd)
+{
+#if ICS_SIZE_CLASSES
+    ics_size_class_header header = { ICS_SIZE_CLASS_MAGIC, ICS_SIZE_CLASS_VERSION, BLOCK_GRANULE, 0 };
+
+    if(fd < 0) return errno = EINVAL, -1;
+    if(!__atomic_load_n(&classesReady, __ATOMIC_ACQUIRE)) return errno = EAGAIN, -1;
+
+    header.count = classCount;
+    if( writeSnapshotBytes(fd, &header, sizeof(header)) == -1 ||
+        writeSnapshotBytes(fd, classSizes, classCount * sizeof(*classSizes)) == -1 )
+    {
+        return -1;
+    }
+
+    return 0;
+#else
+    return errno = EINVAL, -1;
+#endif
+}
+
+/*
+ * Reads a table written by ics_size_classes_export() from fd and uses it in
+ * place of the one ics_malloc would derive, so a service starts with the
+ * classes tuned by its previous runs. Call it right after ics_mem_init(),
+ * before the first allocation.
+ *
+ * @param fd Open file descriptor the table is read from.
+ *
+ * @return 0 upon success, -1 if error and set errno accordingly.
+ *
+ * If fd is invalid, the allocator was built without ICS_SIZE_CLASSES, classes
+ * are already in use, or the table is truncated, was written for another
+ * BLOCK_GRANULE or holds sizes this build cannot use, errno is set to EINVAL.
+ * If reading fails, errno is left as set by read(2).
+ */
+int
+ics_size_classes_load(int fd)
+{
+#if ICS_SIZE_CLASSES
+    ics_size_class_header header;
+    uint32_t sizes[ICS_SIZE_CLASSES];
+    char *buffer = (char*)&header;
+    size_t length = sizeof(header), done = 0;
+    ssize_t bytes = 0;
+    unsigned int i = 0;
+
+    if(fd < 0 || __atomic_load_n(&classesReady, __ATOMIC_ACQUIRE)) return errno = EINVAL, -1;
+
+    // First the header, then as many sizes as it announces.
+    for(i = 0; i < 2; ++i)
+    {
+        for(done = 0; done < length; done += bytes)
+        {
+            if( ( bytes = read(fd, buffer + done, length - done) ) == -1 && errno == EINTR )
+            {
+                bytes = 0;
+                continue;
+            }
+            if(bytes == -1) return -1;
+            if(bytes == 0) return errno = EINVAL, -1;
+        }
+
+        if(i == 0)
+        {
+            if( header.magic != ICS_SIZE_CLASS_MAGIC || header.version != ICS_SIZE_CLASS_VERSION ||
+                header.block_granule != BLOCK_GRANULE || header.count > ICS_SIZE_CLASSES )
+            {
+                return errno = EINVAL, -1;
+            }
+            buffer = (char*)sizes;
+            length = header.count * sizeof(*sizes);
+        }
+    }
+
+    for(i = 0; i < header.count; ++i)
+    {
+        if( sizes[i] < MIN_BLOCK_SIZE || sizes[i] > ICS_CLASS_MAX_BLOCK || sizes[i] % BLOCK_GRANULE ||
+            (i && sizes[i] <= sizes[i - 1]) )
+        {
+            return errno = EINVAL, -1;
+        }
+    }
+
+    setSizeClasses(sizes, header.count);
+
+    return 0;
+#else
+    return errno = EINVAL, -1;
+#endif
+}
+
+#if ICS_SIZE_CLASSES
+size_t
+classBlockSize(size_t blockSize)
+{
+    size_t slot = blockSize / BLOCK_GRANULE;
+
+    if(blockSize > ICS_CLASS_MAX_BLOCK) return blockSize;
+
+    if(__atomic_load_n(&classesReady, __ATOMIC_ACQUIRE))
+        return classBlock[slot] ? classBlock[slot] : blockSize;
+
+    __atomic_fetch_add(&classHistogram[slot], 1, __ATOMIC_RELAXED);
+    if(__atomic_sub_fetch(&classWarmup, 1, __ATOMIC_RELAXED) == 0) deriveSizeClasses();
+
+    return blockSize;
+}
+
+// The class blockSize rounds up to, like classBlockSize but without counting a request.
+size_t
+findSizeClass(size_t blockSize)
+{
+    size_t slot = blockSize / BLOCK_GRANULE;
+
+    if(blockSize > ICS_CLASS_MAX_BLOCK || !__atomic_load_n(&classesReady, __ATOMIC_ACQUIRE)) return blockSize;
+
+    return classBlock[slot] ? classBlock[slot] : blockSize;
+}
+
+void
+deriveSizeClasses()
+{
+    uint64_t weight[CLASS_SLOTS + 1], weighted[CLASS_SLOTS + 1], cost = 0;
+    uint16_t slots[CLASS_SLOTS];
+    uint32_t sizes[ICS_SIZE_CLASSES], count = 0;
+    unsigned int distinct = 0, classes = 0, i = 0, j = 0, k = 0;
+
+    // Only the sizes seen can be class boundaries; weight and weighted are prefix sums over them.
+    weight[0] = weighted[0] = 0;
+    for(i = 0; i < CLASS_SLOTS; ++i)
+    {
+        if( !( count = __atomic_load_n(&classHistogram[i], __ATOMIC_RELAXED) ) ) continue;
+
+        slots[distinct] = i;
+        weight[distinct + 1] = weight[distinct] + count;
+        weighted[distinct + 1] = weighted[distinct] + (uint64_t)count * i;
+        ++distinct;
+    }
+    classes = distinct < ICS_SIZE_CLASSES ? distinct : ICS_SIZE_CLASSES;
+
+    /*
+     * classCost[k][j] is the least waste, in granules, of covering the j
+     * smallest sizes with k classes, the last of them being slots[j - 1].
+     * Sizes i to j - 1 rounded up to slots[j - 1] waste
+     * slots[j - 1] * (weight[j] - weight[i]) - (weighted[j] - weighted[i]).
+     */
+    for(j = 1; j <= distinct; ++j)
+    {
+        classCost[1][j] = slots[j - 1] * weight[j] - weighted[j];
+        classCut[1][j] = 0;
+    }
+    for(k = 2; k <= classes; ++k)
+    {
+        for(j = k; j <= distinct; ++j)
+        {
+            classCost[k][j] = UINT64_MAX;
+            for(i = k - 1; i < j; ++i)
+            {
+                cost = classCost[k - 1][i] + slots[j - 1] * (weight[j] - weight[i]) - (weighted[j] - weighted[i]);
+                if(cost < classCost[k][j])
+                {
+                    classCost[k][j] = cost;
+                    classCut[k][j] = i;
+                }
+            }
+        }
+    }
+
+    for(k = classes, j = distinct; k > 0; j = classCut[k][j], --k)
+    {
+        sizes[k - 1] = slots[j - 1] * BLOCK_GRANULE;
+    }
+
+    setSizeClasses(sizes, classes);
+}
+
+void
+setSizeClasses(const uint32_t *sizes, unsigned int count)
+{
+    unsigned int slot = 0, current = 0;
+
+    for(slot = 0; slot < CLASS_SLOTS; ++slot)
+    {
+        while(current < count && sizes[current] < slot * BLOCK_GRANULE) ++current;
+        classBlock[slot] = current < count ? sizes[current] : 0;
+    }
+
+    memcpy(classSizes, sizes, count * sizeof(*sizes));
+    classCount = count;
+    __atomic_store_n(&classesReady, 1, __ATOMIC_RELEASE);
+}
+#endif
@@ -0,0 +1,80 @@
+#include "helpers.h"
+#include "debug.h"
+
+
+#if ICS_THREAD_SAFE
+/*
+ * fork() copies the heaps of every thread but only the calling thread lives on
+ * in the child. A heap whose owner was halfway through ics_malloc or ics_free
+ * would be copied in that state, so every owner holds its heap's lock while it
+ * changes the heap, and the pthread_atfork handlers below take all of them,
+ * together with heapRegistryLock, before the fork. The child then starts with
+ * consistent heaps and fresh locks.
+ *
+ * heapLockDepth counts the nested allocator calls of this thread (ics_realloc
+ * calling ics_malloc, a pressure handler calling ics_free) so only the
+ * outermost one takes the lock. When fork() is called from a signal handler
+ * that interrupted the allocator in the same thread, that heap is left as it
+ * is: the interrupted call resumes in the parent and in the child alike.
+ */
+ICS_HEAP_LOCAL unsigned int heapLockDepth = 0;
+
+
+void
+lockHeap()
+{
+    if(heapLockDepth++ == 0 && localHeap) pthread_mutex_lock(&localHeap->lock);
+}
+
+void
+unlockHeap()
+{
+    if(--heapLockDepth == 0 && localHeap) pthread_mutex_unlock(&localHeap->lock);
+}
+
+void
+prepareFork()
+{
+    unsigned int i = 0, count = 0;
+
+    pthread_mutex_lock(&heapRegistryLock);
+    count = heapCount > ICS_MAX_HEAPS ? ICS_MAX_HEAPS : heapCount;
+
+    // Every thread only ever holds its own heap's lock, so taking them in slot order cannot deadlock.
+    for(i = 0; i < count; ++i)
+    {
+        if(!heaps[i].base || (&heaps[i] == localHeap && heapLockDepth)) continue;
+        pthread_mutex_lock(&heaps[i].lock);
+    }
+}
+
+void
+resumeForkParent()
+{
+    unsigned int i = 0, count = heapCount > ICS_MAX_HEAPS ? ICS_MAX_HEAPS : heapCount;
+
+    for(i = count; i-- > 0;)
+    {
+        if(!heaps[i].base || (&heaps[i] == localHeap && heapLockDepth)) continue;
+        pthread_mutex_unlock(&heaps[i].lock);
+    }
+
+    pthread_mutex_unlock(&heapRegistryLock);
+}
+
+void
+resumeForkChild()
+{
+    unsigned int i = 0, count = heapCount > ICS_MAX_HEAPS ? ICS_MAX_HEAPS : heapCount;
+
+    // The other threads are gone; their heaps keep the blocks they held and queue frees of them as before.
+    for(i = 0; i < count; ++i)
+    {
+        if(!heaps[i].base) continue;
+        pthread_mutex_init(&heaps[i].lock, NULL);
+    }
+    if(localHeap && heapLockDepth) pthread_mutex_lock(&localHeap->lock);
+
+    pthread_mutex_init(&heapRegistryLock, NULL);
+}
+#endif
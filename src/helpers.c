@@ -2,38 +2,57 @@
 #include "debug.h"
 
 
+/*
+ * The blocks allocated with ICS_GROWABLE most recently, oldest overwritten
+ * first. A growable block at the top of the heap keeps it to itself, and
+ * ics_realloc places the copy of a growable block that had to move as
+ * growable again. An entry can outlive its block; that only costs a hint.
+ */
+static ICS_HEAP_LOCAL ics_free_header *growableBlocks[ICS_GROWABLE_SLOTS];
+static ICS_HEAP_LOCAL unsigned int growableNext = 0;
+
 int8_t
 initHeap() 
 {
     char *firstPageStart = NULL;
+    ics_free_header *firstBlock = NULL;
     ics_footer *epilogue = NULL, *footer = NULL;
 
-    if ( ( firstPageStart = (char*)ics_inc_brk() ) == (void*)-1 ) return -1;
-    ++pagesCount;
+#if ICS_THREAD_SAFE
+    // A heap left behind by an exited thread is taken over before a new one is reserved.
+    if(adoptHeap() == 1) return 1;
+#endif
+    if ( ( firstPageStart = (char*)incHeapBrk(1) ) == (void*)-1 ) return -1;
+    memset(growableBlocks, 0, sizeof(growableBlocks));
 
-    prologue = (ics_header*)firstPageStart;
+    prologue = (ics_header*)(firstPageStart + HEAP_START_PAD);
     prologue->block_size = 0;
     prologue->block_size = SET_ALLOCATED_FLAG(0);
     prologue->hid = HEADER_MAGIC;
     prologue->requested_size = 0;
 
-    epilogue = GET_EPILOGUE_ADDR(firstPageStart);
+    epilogue = GET_EPILOGUE_ADDR(getHeapBrk());
     epilogue->block_size = 0;
     epilogue->block_size = SET_ALLOCATED_FLAG(0);
     epilogue->fid = FOOTER_MAGIC;
     epilogue->requested_size = 0;
 
-    freelist_head = (ics_free_header*)(firstPageStart + PROLOGUE_SIZE);
-    freelist_head->header.block_size = PAGE_SIZE - PROLOGUE_SIZE - EPILOGUE_SIZE;
-    freelist_head->header.hid = HEADER_MAGIC;
-    freelist_head->header.requested_size = 0;
-    freelist_head->next = NULL;
-    freelist_head->prev = NULL;
+    firstBlock = (ics_free_header*)((char*)prologue + PROLOGUE_SIZE);
+    firstBlock->header.block_size = PAGE_SIZE - HEAP_START_PAD - PROLOGUE_SIZE - EPILOGUE_SIZE;
+    firstBlock->header.hid = HEADER_MAGIC;
+    firstBlock->header.requested_size = 0;
+    SET_NEXT_FREE(firstBlock, NULL);
+    SET_PREV_FREE(firstBlock, NULL);
 
-    footer = initFooter(freelist_head);
+    footer = initFooter(firstBlock);
     (void)footer;
 
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    tlsfInsert(firstBlock);
+#else
+    freelist_head = firstBlock;
     freelist_next = freelist_head;
+#endif
 
     return 1;
 }
@@ -51,74 +70,139 @@ initFooter(ics_free_header *block)
 ics_free_header*
 findNextFit(size_t requestedSize) 
 {
-    ics_free_header *temp = freelist_next;
+    ics_free_header *temp = NULL;
+
+#if ICS_HUGEPAGES
+    // Address-ordered first fit keeps blocks packed in the lowest, already backed huge pages.
+    freelist_next = freelist_head;
+#endif
+    temp = freelist_next;
 
     while(freelist_next) 
     {
         if(freelist_next->header.block_size >= requestedSize) return freelist_next;
-        freelist_next = freelist_next->next;
+        freelist_next = NEXT_FREE(freelist_next);
     }
 
     freelist_next = freelist_head;
     while(freelist_next != temp) 
     {
         if(freelist_next->header.block_size >= requestedSize) return freelist_next;
-        freelist_next = freelist_next->next;
+        freelist_next = NEXT_FREE(freelist_next);
     }
 
     return NULL;
 }
 
 ics_free_header*
-extendHeap(size_t requestedSize) 
+findGrowableFit(size_t blockSize)
 {
-    if(pagesCount >= MAX_PAGES) return NULL;
+    ics_footer *lastFooter = GET_PREV_FOOTER(GET_EPILOGUE_ADDR(getHeapBrk()));
+    ics_free_header *topBlock = NULL, *lastBlock = NULL, *largest = NULL;
+    size_t lowerSize = 0;
 
-    char *newPageStart = NULL;
-    ics_free_header *freelist_tail = NULL, *lastBlock = NULL;
-    ics_footer *newEpilogue = NULL, *newFooter = NULL, *lastFooter = NULL;
-    size_t newFreeBlockSize = 0;
+    if(!IS_ALLOCATED(lastFooter->block_size, lastFooter->requested_size))
+    {
+        topBlock = GET_PREV_HEADER(lastFooter, lastFooter->block_size);
+        lastFooter = GET_PREV_FOOTER(topBlock);
+    }
+    lastBlock = GET_PREV_HEADER(lastFooter, CLEAR_ALLOCATED_FLAG(lastFooter->block_size));
 
-    lastFooter = (ics_footer*)((char*)(ics_get_brk()) - EPILOGUE_SIZE - FOOTER_SIZE);
-    lastBlock = (ics_free_header*)((char*)(lastFooter) - lastFooter->block_size + HEADER_SIZE);
-    freelist_tail = getFreelistTail();
+    // The top of the heap, while the heap can grow by the block's size and no other growable block grows there.
+    if(isGrowableBlock(lastBlock, 0) == -1 && heapPagesLeft() * PAGE_SIZE >= blockSize)
+    {
+        if(topBlock && topBlock->header.block_size >= blockSize)
+        {
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+            tlsfRemove(topBlock);
+#endif
+            return topBlock;
+        }
+        if( ( topBlock = extendHeap(blockSize) ) ) return topBlock;
+    }
 
-    if( (newPageStart = (char*) ics_inc_brk() ) == (void*)-1 ) return NULL;
-    ++pagesCount;
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    largest = tlsfFindLargest();
+#else
+    ics_free_header *current = NULL;
 
-    if(freelist_tail != lastBlock) 
+    for(current = freelist_head; current; current = NEXT_FREE(current))
     {
-        freelist_tail = NULL;
-        newFreeBlockSize = PAGE_SIZE;
+        if(!largest || current->header.block_size > largest->header.block_size) largest = current;
     }
-    else
+#endif
+    if(!largest || largest->header.block_size < blockSize) return NULL;
+
+    // Elsewhere it needs free space below it for other allocations and room behind it to grow into.
+    lowerSize = (largest->header.block_size - blockSize) / 2 / BLOCK_GRANULE * BLOCK_GRANULE;
+    if(lowerSize < MIN_BLOCK_SIZE || largest->header.block_size - lowerSize - blockSize < MIN_BLOCK_SIZE) return NULL;
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    tlsfRemove(largest);
+#endif
+
+    return largest;
+}
+
+ics_free_header*
+extendHeap(size_t requestedSize) 
+{
+    char *newPageStart = NULL;
+    ics_free_header *freelist_tail = NULL;
+    ics_footer *newEpilogue = NULL, *newFooter = NULL, *lastFooter = NULL;
+    size_t newFreeBlockSize = 0, pages = 0;
+
+    // The footer in front of the epilogue tells whether the physically last block is free.
+    lastFooter = GET_PREV_FOOTER(GET_EPILOGUE_ADDR(getHeapBrk()));
+    if(!IS_ALLOCATED(lastFooter->block_size, lastFooter->requested_size))
     {
-        newFreeBlockSize = freelist_tail->header.block_size + PAGE_SIZE;
+        freelist_tail = GET_PREV_HEADER(lastFooter, lastFooter->block_size);
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+        // tlsfFindFit rounds the size up to a whole list, so it can miss a tail block that fits.
+        if(freelist_tail->header.block_size >= requestedSize)
+        {
+            tlsfRemove(freelist_tail);
+            return freelist_tail;
+        }
+#endif
+        pages = ( requestedSize - freelist_tail->header.block_size + PAGE_SIZE - 1 ) / PAGE_SIZE;
     }
 
-    while(newFreeBlockSize < requestedSize) 
+    if(!freelist_tail || freelist_tail->header.block_size + pages * PAGE_SIZE > MAX_BLOCK_SIZE) 
     {
-        if(pagesCount >= MAX_PAGES) return NULL;
-        if( (newPageStart = (char*) ics_inc_brk() ) == (void*)-1 ) return NULL;
-        ++pagesCount;
-        newFreeBlockSize += PAGE_SIZE;
+        freelist_tail = NULL;
+        pages = ( requestedSize + PAGE_SIZE - 1 ) / PAGE_SIZE;
+        // Whole pages can overshoot the largest block the header can describe.
+        if(pages * PAGE_SIZE > MAX_BLOCK_SIZE) return NULL;
     }
 
+    if( (newPageStart = (char*) incHeapBrk(pages) ) == (void*)-1 ) return NULL;
+
+    newFreeBlockSize = pages * PAGE_SIZE;
+    if(freelist_tail) newFreeBlockSize += freelist_tail->header.block_size;
+
     if(!freelist_tail) 
     {
         freelist_tail = (ics_free_header*)(newPageStart - EPILOGUE_SIZE);
         freelist_tail->header.hid = HEADER_MAGIC;
         freelist_tail->header.requested_size = 0;
-        freelist_tail->prev = NULL;
-        freelist_tail->next = NULL;
+        SET_PREV_FREE(freelist_tail, NULL);
+        SET_NEXT_FREE(freelist_tail, NULL);
+#if ICS_ENGINE != ICS_ENGINE_TLSF
         insertInOrderToFreelist(freelist_tail);
+#endif
+    }
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    else
+    {
+        tlsfRemove(freelist_tail);
     }
+#endif
     freelist_tail->header.block_size = newFreeBlockSize;
 
     newFooter = initFooter(freelist_tail);
     (void)newFooter;
 
-    newEpilogue = GET_EPILOGUE_ADDR(newPageStart);
+    newEpilogue = GET_EPILOGUE_ADDR(getHeapBrk());
     newEpilogue->block_size = SET_ALLOCATED_FLAG(0);
     newEpilogue->fid = FOOTER_MAGIC;
     newEpilogue->requested_size = 0;
@@ -126,21 +210,6 @@ extendHeap(size_t requestedSize)
     return freelist_tail;
 }
 
-ics_free_header* 
-getFreelistTail() 
-{
-    if(!freelist_head) return NULL;
-
-    ics_free_header *freelist_tail = freelist_head;
-
-    while(freelist_tail->next) 
-    {
-        freelist_tail = freelist_tail->next;
-    }
-
-    return freelist_tail;
-}
-
 void
 splitBlock(ics_free_header *targetBlock, size_t blockSize) 
 {
@@ -155,10 +224,89 @@ splitBlock(ics_free_header *targetBlock, size_t blockSize)
     newBlockFooter = initFooter(newBlock);
     (void)newBlockFooter;
 
-    newBlock->next = targetBlock->next;
-    newBlock->prev = targetBlock;
-    if(targetBlock->next) targetBlock->next->prev = newBlock;
-    targetBlock->next = newBlock;
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    tlsfInsert(newBlock);
+#else
+    SET_NEXT_FREE(newBlock, NEXT_FREE(targetBlock));
+    SET_PREV_FREE(newBlock, targetBlock);
+    if(NEXT_FREE(targetBlock)) SET_PREV_FREE(NEXT_FREE(targetBlock), newBlock);
+    SET_NEXT_FREE(targetBlock, newBlock);
+#endif
+}
+
+void*
+placeBlock(ics_free_header *targetBlock, size_t blockSize, size_t requestedSize)
+{
+#if ICS_HARDENED
+    checkFreeBlock(targetBlock);
+#endif
+
+    if(targetBlock->header.block_size - blockSize >= MIN_BLOCK_SIZE)
+        splitBlock(targetBlock, blockSize);
+    else
+        blockSize = targetBlock->header.block_size;
+
+    return allocateBlock(targetBlock, blockSize, requestedSize);
+}
+
+void*
+placeGrowableBlock(ics_free_header *targetBlock, size_t blockSize, size_t requestedSize)
+{
+    ics_free_header *upperBlock = NULL;
+    size_t lowerSize = targetBlock->header.block_size - blockSize;
+    int8_t atTop = (char*)GET_NEXT_HEADER(targetBlock, targetBlock->header.block_size) == (char*)GET_EPILOGUE_ADDR(getHeapBrk());
+    void *ptr = NULL;
+
+    // At the top the block takes the upper end and grows into new pages, elsewhere it starts the upper half.
+    if(!atTop) lowerSize = lowerSize / 2 / BLOCK_GRANULE * BLOCK_GRANULE;
+    if(lowerSize < MIN_BLOCK_SIZE)
+    {
+        rememberGrowableBlock(targetBlock);
+        return placeBlock(targetBlock, blockSize, requestedSize);
+    }
+#if ICS_HARDENED
+    checkFreeBlock(targetBlock);
+#endif
+
+    // The lower part stays free (and in the free list for next-fit).
+    splitBlock(targetBlock, lowerSize);
+    targetBlock->header.block_size = lowerSize;
+    initFooter(targetBlock);
+    upperBlock = GET_NEXT_HEADER(targetBlock, lowerSize);
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    tlsfInsert(targetBlock);
+    tlsfRemove(upperBlock);
+#endif
+
+    rememberGrowableBlock(upperBlock);
+    ptr = placeBlock(upperBlock, blockSize, requestedSize);
+#if ICS_ENGINE != ICS_ENGINE_TLSF
+    // Next-fit goes on below the block, so the space behind it stays free the longest.
+    freelist_next = targetBlock;
+#endif
+
+    return ptr;
+}
+
+void
+rememberGrowableBlock(ics_free_header *block)
+{
+    growableBlocks[growableNext++ % ICS_GROWABLE_SLOTS] = block;
+}
+
+int8_t
+isGrowableBlock(ics_free_header *block, int8_t forget)
+{
+    unsigned int i = 0;
+
+    for(i = 0; i < ICS_GROWABLE_SLOTS; ++i)
+    {
+        if(growableBlocks[i] != block) continue;
+        if(forget) growableBlocks[i] = NULL;
+        return 1;
+    }
+
+    return -1;
 }
 
 void*
@@ -173,25 +321,129 @@ allocateBlock(ics_free_header *targetBlock, size_t blockSize, size_t requestedSi
     targetBlockFooter = initFooter(targetBlock);
     (void)targetBlockFooter;
 
-    if(targetBlock == freelist_head) freelist_head = targetBlock->next;
+#if ICS_ENGINE != ICS_ENGINE_TLSF
+    if(targetBlock == freelist_head) freelist_head = NEXT_FREE(targetBlock);
 
-    if(targetBlock->next) freelist_next = targetBlock->next;
+    if(NEXT_FREE(targetBlock)) freelist_next = NEXT_FREE(targetBlock);
     else freelist_next = freelist_head;
 
-    if(targetBlock->prev) targetBlock->prev->next = targetBlock->next;
-    if(targetBlock->next) targetBlock->next->prev = targetBlock->prev;
-    targetBlock->next = NULL;
-    targetBlock->prev = NULL;
+    if(PREV_FREE(targetBlock)) SET_NEXT_FREE(PREV_FREE(targetBlock), NEXT_FREE(targetBlock));
+    if(NEXT_FREE(targetBlock)) SET_PREV_FREE(NEXT_FREE(targetBlock), PREV_FREE(targetBlock));
+    SET_NEXT_FREE(targetBlock, NULL);
+    SET_PREV_FREE(targetBlock, NULL);
+#endif
     
     return GET_CURR_PLAYLOAD(targetBlock);
 }
 
+int8_t
+growBlock(ics_free_header *block, size_t blockSize, size_t requestedSize)
+{
+    size_t currSize = CLEAR_ALLOCATED_FLAG(block->header.block_size), freeSize = 0, pages = 0;
+    ics_free_header *nextBlock = GET_NEXT_HEADER(block, currSize), *remainder = NULL;
+    ics_footer *epilogue = GET_EPILOGUE_ADDR(getHeapBrk());
+
+#if ICS_THREAD_SAFE
+    if(isInHeap((char*)block) == -1) return -1;
+#endif
+
+    // Shrinking far enough to split the block is left to the caller.
+    if(currSize >= blockSize)
+    {
+        if(currSize - blockSize >= MIN_BLOCK_SIZE) return -1;
+
+        block->header.requested_size = requestedSize;
+        initFooter(block);
+        return 1;
+    }
+
+    // Header and footer both, so a block queued for a remote free is never taken.
+    if( (char*)nextBlock != (char*)epilogue &&
+        checkAdjBlockAvailability(nextBlock, GET_NEXT_FOOTER(nextBlock, CLEAR_ALLOCATED_FLAG(nextBlock->header.block_size))) == 1 )
+    {
+        freeSize = CLEAR_ALLOCATED_FLAG(nextBlock->header.block_size);
+    }
+
+    // Without a remainder to split off, the whole free block must fit the header.
+    if( currSize + freeSize >= blockSize && currSize + freeSize - blockSize < MIN_BLOCK_SIZE &&
+        currSize + freeSize > MAX_BLOCK_SIZE )
+    {
+        return -1;
+    }
+
+    // A block that ends at the epilogue, directly or through a free block, grows with the heap.
+    if(currSize + freeSize < blockSize)
+    {
+        if((char*)nextBlock + freeSize != (char*)epilogue) return -1;
+
+        pages = ( blockSize - currSize - freeSize + PAGE_SIZE - 1 ) / PAGE_SIZE;
+        if(currSize + freeSize + pages * PAGE_SIZE > MAX_BLOCK_SIZE) return -1;
+        if(incHeapBrk(pages) == (void*)-1) return -1;
+
+        epilogue = GET_EPILOGUE_ADDR(getHeapBrk());
+        epilogue->block_size = SET_ALLOCATED_FLAG(0);
+        epilogue->fid = FOOTER_MAGIC;
+        epilogue->requested_size = 0;
+    }
+
+    if(freeSize) unlinkFreeBlock(nextBlock);
+
+    currSize += freeSize + pages * PAGE_SIZE;
+    if(currSize - blockSize >= MIN_BLOCK_SIZE)
+    {
+        remainder = GET_NEXT_HEADER(block, blockSize);
+        remainder->header.block_size = currSize - blockSize;
+        remainder->header.hid = HEADER_MAGIC;
+        remainder->header.requested_size = 0;
+        SET_NEXT_FREE(remainder, NULL);
+        SET_PREV_FREE(remainder, NULL);
+        initFooter(remainder);
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+        tlsfInsert(remainder);
+#else
+        insertInOrderToFreelist(remainder);
+#endif
+    }
+    else
+    {
+        blockSize = currSize;
+    }
+
+    block->header.block_size = SET_ALLOCATED_FLAG(blockSize);
+    block->header.requested_size = requestedSize;
+    initFooter(block);
+
+    return 1;
+}
+
+void
+unlinkFreeBlock(ics_free_header *block)
+{
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    tlsfRemove(block);
+#else
+    if(block == freelist_head) freelist_head = NEXT_FREE(block);
+    if(block == freelist_next) freelist_next = block->next ? NEXT_FREE(block) : freelist_head;
+
+    if(PREV_FREE(block)) SET_NEXT_FREE(PREV_FREE(block), NEXT_FREE(block));
+    if(NEXT_FREE(block)) SET_PREV_FREE(NEXT_FREE(block), PREV_FREE(block));
+    SET_NEXT_FREE(block, NULL);
+    SET_PREV_FREE(block, NULL);
+#endif
+}
+
 int8_t
 isBlockValid(ics_free_header *block, ics_footer *footer)
 {
-    if( isInHeap( (char*)block ) == -1 ||
-        isInHeap( (char*)footer ) == -1 ||
-        block->header.hid != HEADER_MAGIC ||
+    return ( isInHeap( (char*)block ) == 1 &&
+             isInHeap( (char*)footer ) == 1 ) ?
+                hasValidTags(block, footer) : -1;
+}
+
+int8_t
+hasValidTags(ics_free_header *block, ics_footer *footer)
+{
+    if( block->header.hid != HEADER_MAGIC ||
         footer->fid != FOOTER_MAGIC ||
         block->header.block_size != footer->block_size ||
         block->header.requested_size != footer->requested_size ||
@@ -203,14 +455,56 @@ isBlockValid(ics_free_header *block, ics_footer *footer)
     return 1;
 }
 
+#if ICS_HARDENED
+void
+checkFreeBlock(ics_free_header *block)
+{
+    ics_footer *footer = GET_CURR_FOOTER(block, block->header.block_size);
+
+    if( block->header.hid != HEADER_MAGIC ||
+        footer->fid != FOOTER_MAGIC ||
+        block->header.block_size != footer->block_size ||
+        block->header.requested_size != 0 ||
+        footer->requested_size != 0 )
+    {
+        error("free block %p was overwritten while not allocated\n", (void*)block);
+        abort();
+    }
+}
+#endif
+
 int8_t
 isInHeap(char *block)
 {
-    return ( block >= (char*)((char*)(prologue) + PROLOGUE_SIZE) && 
-             block < (char*)((char*)(ics_get_brk()) - EPILOGUE_SIZE) ) ?
+    return ( prologue &&
+             block >= (char*)((char*)(prologue) + PROLOGUE_SIZE) && 
+             block < (char*)((char*)(getHeapBrk()) - EPILOGUE_SIZE) ) ?
                 1 : -1;
 }
 
+int8_t
+releaseBlock(ics_free_header *block, ics_footer *footer)
+{
+#if ICS_HARDENED
+    memset(GET_CURR_PLAYLOAD(block), ICS_POISON_BYTE, CLEAR_ALLOCATED_FLAG(block->header.block_size) - HEADER_SIZE - FOOTER_SIZE);
+#endif
+
+    block->header.block_size = CLEAR_ALLOCATED_FLAG(block->header.block_size);
+    block->header.requested_size = 0;
+    SET_NEXT_FREE(block, NULL);
+    SET_PREV_FREE(block, NULL);
+
+    if( coalesceBlocks(&block, &footer) == -1 ) return -1;
+
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    tlsfInsert(block);
+#else
+    insertInOrderToFreelist(block);
+#endif
+
+    return 1;
+}
+
 int8_t
 coalesceBlocks(ics_free_header **currBlock, ics_footer **currFooter)
 {
@@ -242,12 +536,32 @@ coalesceBlocks(ics_free_header **currBlock, ics_footer **currFooter)
     isPrevFree = checkAdjBlockAvailability(prevBlock, prevFooter);
     isNextFree = checkAdjBlockAvailability(nextBlock, nextFooter);
 
+    // Neighbours stay separate free blocks when the merged size would overflow block_size.
+    if( isPrevFree != -1 &&
+        prevBlock->header.block_size + (*currBlock)->header.block_size > MAX_BLOCK_SIZE )
+        isPrevFree = -1;
+    if( isNextFree != -1 &&
+        (isPrevFree != -1 ? prevBlock->header.block_size : 0) + (*currBlock)->header.block_size + nextBlock->header.block_size > MAX_BLOCK_SIZE )
+        isNextFree = -1;
+
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    if(isPrevFree != -1)
+    {
+        tlsfRemove(prevBlock);
+        coalescePrevBlock(currBlock, prevBlock);
+    }
+    if(isNextFree != -1)
+    {
+        tlsfRemove(nextBlock);
+        coalesceNextBlock(currBlock, nextBlock);
+    }
+#else
     if(isPrevFree != -1 && isNextFree != -1)
     {
         if( !findBlockInFreelist(prevBlock) ) return -1;
         if( !findBlockInFreelist(nextBlock) ) return -1;
-        if(prevBlock == freelist_head) freelist_head = freelist_head->next;
-        if(nextBlock == freelist_head) freelist_head = freelist_head->next;
+        if(prevBlock == freelist_head) freelist_head = NEXT_FREE(freelist_head);
+        if(nextBlock == freelist_head) freelist_head = NEXT_FREE(freelist_head);
         if(freelist_next == nextBlock) freelist_next = prevBlock;
 
         coalescePrevBlock(currBlock, prevBlock);
@@ -256,18 +570,19 @@ coalesceBlocks(ics_free_header **currBlock, ics_footer **currFooter)
     else if(isPrevFree != -1)
     {
         if( !findBlockInFreelist(prevBlock) ) return -1;
-        if(prevBlock == freelist_head) freelist_head = freelist_head->next;
+        if(prevBlock == freelist_head) freelist_head = NEXT_FREE(freelist_head);
 
         coalescePrevBlock(currBlock, prevBlock);
     }
     else if(isNextFree != -1)
     {
         if( !findBlockInFreelist(nextBlock) ) return -1;
-        if(nextBlock == freelist_head) freelist_head = freelist_head->next;
+        if(nextBlock == freelist_head) freelist_head = NEXT_FREE(freelist_head);
         if(freelist_next == nextBlock) freelist_next = *currBlock;
 
         coalesceNextBlock(currBlock, nextBlock);
     }
+#endif
 
     *currFooter = initFooter(*currBlock);
 
@@ -277,10 +592,10 @@ coalesceBlocks(ics_free_header **currBlock, ics_footer **currFooter)
 void
 coalescePrevBlock(ics_free_header **currBlock, ics_free_header *prevBlock)
 {
-    if(prevBlock->prev) prevBlock->prev->next = prevBlock->next;
-    if(prevBlock->next) prevBlock->next->prev = prevBlock->prev;
-    prevBlock->prev = NULL;
-    prevBlock->next = NULL;
+    if(PREV_FREE(prevBlock)) SET_NEXT_FREE(PREV_FREE(prevBlock), NEXT_FREE(prevBlock));
+    if(NEXT_FREE(prevBlock)) SET_PREV_FREE(NEXT_FREE(prevBlock), PREV_FREE(prevBlock));
+    SET_PREV_FREE(prevBlock, NULL);
+    SET_NEXT_FREE(prevBlock, NULL);
 
     prevBlock->header.block_size += (*currBlock)->header.block_size;
     *currBlock = prevBlock;
@@ -289,10 +604,10 @@ coalescePrevBlock(ics_free_header **currBlock, ics_free_header *prevBlock)
 void
 coalesceNextBlock(ics_free_header **currBlock, ics_free_header *nextBlock)
 {
-    if(nextBlock->prev) nextBlock->prev->next = nextBlock->next;
-    if(nextBlock->next) nextBlock->next->prev = nextBlock->prev;
-    nextBlock->prev = NULL;
-    nextBlock->next = NULL;
+    if(PREV_FREE(nextBlock)) SET_NEXT_FREE(PREV_FREE(nextBlock), NEXT_FREE(nextBlock));
+    if(NEXT_FREE(nextBlock)) SET_PREV_FREE(NEXT_FREE(nextBlock), PREV_FREE(nextBlock));
+    SET_PREV_FREE(nextBlock, NULL);
+    SET_NEXT_FREE(nextBlock, NULL);
 
     (*currBlock)->header.block_size += nextBlock->header.block_size;
 }
@@ -306,7 +621,7 @@ findBlockInFreelist(ics_free_header *block)
     
     while(current && current != block)
     {
-        current = current->next;
+        current = NEXT_FREE(current);
     }
 
     return current;
@@ -337,8 +652,8 @@ insertInOrderToFreelist(ics_free_header *block)
     }
     if(block < freelist_head)
     {
-        block->next = freelist_head;
-        freelist_head->prev = block;
+        SET_NEXT_FREE(block, freelist_head);
+        SET_PREV_FREE(freelist_head, block);
         freelist_head = block;
         return;
     }
@@ -349,19 +664,19 @@ insertInOrderToFreelist(ics_free_header *block)
     {
         if(current && current > block)
         {
-            block->next = current;
-            block->prev = current->prev;
-            current->prev->next = block;
-            current->prev = block;
+            SET_NEXT_FREE(block, current);
+            SET_PREV_FREE(block, PREV_FREE(current));
+            SET_NEXT_FREE(PREV_FREE(current), block);
+            SET_PREV_FREE(current, block);
             return;
         }
         if(!current->next)
         {
-            block->prev = current;
-            block->next = NULL;
-            current->next = block;
+            SET_PREV_FREE(block, current);
+            SET_NEXT_FREE(block, NULL);
+            SET_NEXT_FREE(current, block);
             return;
         }
-        current = current->next;
+        current = NEXT_FREE(current);
     }
 }
@@ -10,25 +10,47 @@
  * Doing so will make it accessible via the extern keyword.
  * This will allow ics_freelist_print to access the value from a different file.
  */
-ics_free_header *freelist_head = NULL;
+ICS_HEAP_LOCAL ics_free_header *freelist_head = NULL;
 
 /*
  * The allocator MUST use this pointer to refer to the position in the free list to 
  * starting searching from. 
  */
-ics_free_header *freelist_next = NULL;
+ICS_HEAP_LOCAL ics_free_header *freelist_next = NULL;
 
 /*
  * Used to record the number of memory page requests.
  */
-unsigned int pagesCount = 0;
+ICS_HEAP_LOCAL unsigned int pagesCount = 0;
+
+ICS_HEAP_LOCAL ics_header *prologue = NULL;
 
+#if ICS_THREAD_SAFE || ICS_COMPACT_LINKS
+/*
+ * Every thread allocates from its own heap through the names above, which
+ * helpers.h maps to thread-local copies, and compact links are no pointers
+ * to follow. lib/icsutil.o still links against the process-wide free list,
+ * which stays empty.
+ */
+#undef freelist_head
+#undef freelist_next
+ics_free_header *freelist_head = NULL;
+ics_free_header *freelist_next = NULL;
+#endif
+#if ICS_THREAD_SAFE
+// Declared by icsmm.h for callers that inspect the heap; with one heap per thread they describe none and stay empty.
+#undef pagesCount
+#undef prologue
+unsigned int pagesCount = 0;
 ics_header *prologue = NULL;
+#define pagesCount heapPagesCount
+#define prologue heapPrologue
+#endif
 
 
 /*
  * This is your implementation of malloc. It acquires uninitialized memory from  
- * ics_inc_brk() that is 16-byte aligned, as needed.
+ * incHeapBrk() that is 16-byte aligned, as needed.
  *
  * @param size The number of bytes requested to be allocated.
  *
@@ -38,37 +60,140 @@ ics_header *prologue = NULL;
  * 
  * If size is 0, then NULL is returned and errno is set to EINVAL - representing
  * an invalid request.
+ *
+ * Before failing with ENOMEM, the handler registered with
+ * ics_set_pressure_handler is called and the allocation retried if it released
+ * memory.
  */
 void*
 ics_malloc(size_t size) 
 {
     ics_free_header *targetBlock = NULL;
     size_t blockSize = 0;
+    void *ptr = NULL;
 
     if(size == 0) return errno = EINVAL, NULL;
 
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+    if(size > BUDDY_TOP_SIZE) return errno = ENOMEM, NULL;
+
+    while( !( ptr = buddyAllocate(size) ) )
+    {
+        if(notifyPressure(ICS_PRESSURE_HARD, size) == -1) return errno = ENOMEM, NULL;
+    }
+#else
+    if(size > MAX_REQUEST_SIZE) return errno = ENOMEM, NULL;
+
     if( pagesCount == 0 &&
         initHeap() == -1 ) 
     {
         errno = ENOMEM;
         return NULL;
     }
+    lockHeap();
+#if ICS_THREAD_SAFE
+    if(__atomic_load_n(&localHeap->remoteFrees, __ATOMIC_RELAXED)) drainRemoteFrees();
+#endif
+#if ICS_NUMA
+    checkHeapNode();
+#endif
 
     blockSize = CALC_ACTUAL_BLOCK_SIZE(size);
+#if ICS_SIZE_CLASSES
+    blockSize = classBlockSize(blockSize);
+#endif
 
-    if( !( targetBlock = findNextFit(blockSize) ) &&
-        !( targetBlock = extendHeap(size) ) ) 
+    // Before failing, give the pressure handler a chance to release memory and retry.
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    while( !( targetBlock = tlsfFindFit(blockSize) ) &&
+#else
+    while( !( targetBlock = findNextFit(blockSize) ) &&
+#endif
+           !( targetBlock = extendHeap(blockSize) ) ) 
     {
-        errno = ENOMEM;
-        return NULL;
+        if(notifyPressure(ICS_PRESSURE_HARD, size) == -1)
+        {
+            unlockHeap();
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    ptr = placeBlock(targetBlock, blockSize, size);
+#endif
+
+#if ICS_PROFILE
+    if( (profileCountdown -= size) < 0 ) profileSample(ptr, size);
+#endif
+    if(softLimitCrossed) notifyPressure(ICS_PRESSURE_SOFT, size);
+    unlockHeap();
+
+    return ptr;
+}
+
+/*
+ * Allocates like ics_malloc, with placement hints.
+ *
+ * @param size The number of bytes requested to be allocated.
+ * @param flags ICS_GROWABLE places the block where ics_realloc can grow it in
+ * place. While the heap can grow by the block's size and no other growable
+ * block sits at its top, the block takes the upper end of the top of the heap
+ * and later grows into new pages. Otherwise it starts the upper half of the
+ * largest free block: the lower half stays free for other allocations, which
+ * next-fit continues with, and the rest is left behind the block. A block that
+ * fits neither is placed like ics_malloc does. In every case ics_realloc
+ * places the copy of the block as growable again if it has to move. 0 places
+ * the block like ics_malloc does.
+ *
+ * @return See ics_malloc.
+ */
+void*
+ics_malloc_flags(size_t size, unsigned int flags)
+{
+    ics_free_header *targetBlock = NULL;
+    size_t blockSize = CALC_ACTUAL_BLOCK_SIZE(size);
+    void *ptr = NULL;
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+    // Buddy blocks only grow by moving to the next order.
+    return ics_malloc(size);
+#else
+    if( !(flags & ICS_GROWABLE) || size == 0 || size > MAX_REQUEST_SIZE ||
+        ( pagesCount == 0 && initHeap() == -1 ) )
+    {
+        return ics_malloc(size);
+    }
+    lockHeap();
+#if ICS_THREAD_SAFE
+    if(__atomic_load_n(&localHeap->remoteFrees, __ATOMIC_RELAXED)) drainRemoteFrees();
+#endif
+#if ICS_NUMA
+    checkHeapNode();
+#endif
+
+    if( !( targetBlock = findGrowableFit(blockSize) ) )
+    {
+        unlockHeap();
+        // Placed like any other block, but still placed as growable when it has to move.
+        if( ( ptr = ics_malloc(size) ) )
+        {
+            lockHeap();
+            rememberGrowableBlock(GET_CURR_HEADER(ptr));
+            unlockHeap();
+        }
+        return ptr;
     }
 
-    if(targetBlock->header.block_size - blockSize >= MIN_BLOCK_SIZE)
-        splitBlock(targetBlock, blockSize);
-    else
-        blockSize = targetBlock->header.block_size;
+    ptr = placeGrowableBlock(targetBlock, blockSize, size);
 
-    return allocateBlock(targetBlock, blockSize, size);
+#if ICS_PROFILE
+    if( (profileCountdown -= size) < 0 ) profileSample(ptr, size);
+#endif
+    if(softLimitCrossed) notifyPressure(ICS_PRESSURE_SOFT, size);
+    unlockHeap();
+
+    return ptr;
+#endif
 }
 
 /*
@@ -94,23 +219,41 @@ ics_free(void *ptr)
 {
     ics_free_header *block = NULL;
     ics_footer *footer = NULL;
+    int order = 0;
 
     if(!ptr) return errno = EINVAL, -1;
 
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+    if( ( order = buddyBlockOrder(ptr) ) == -1 ) return errno = EINVAL, -1;
+#if ICS_PROFILE
+    if(profileLive) profileRemove(ptr);
+#endif
+    buddyRelease(ptr, order);
+
+    return 0;
+#else
+#if ICS_THREAD_SAFE
+    // Blocks of other threads' heaps go back to their owner through its remote free list.
+    if(isInHeap((char*)GET_CURR_HEADER(ptr)) == -1) return freeRemoteBlock(GET_CURR_HEADER(ptr));
+#endif
+#if ICS_HARDENED
+    if((uintptr_t)ptr % ALIGNMENT || isInHeap((char*)GET_CURR_HEADER(ptr)) == -1) return errno = EINVAL, -1;
+#endif
+
     block = GET_CURR_HEADER(ptr);
     footer = GET_CURR_FOOTER(block, CLEAR_ALLOCATED_FLAG(block->header.block_size));
-    if(isBlockValid(block, footer) == -1) return errno = EINVAL, -1;
+    lockHeap();
+    if(isBlockValid(block, footer) == -1) return unlockHeap(), errno = EINVAL, -1;
 
-    block->header.block_size = CLEAR_ALLOCATED_FLAG(block->header.block_size);
-    block->header.requested_size = 0;
-    block->next = NULL;
-    block->prev = NULL;
+#if ICS_PROFILE
+    if(profileLive) profileRemove(ptr);
+#endif
 
-    if( coalesceBlocks(&block, &footer) == -1 ) return errno = ENOMEM, -1;
-
-    insertInOrderToFreelist(block);
+    if( releaseBlock(block, footer) == -1 ) return unlockHeap(), errno = ENOMEM, -1;
+    unlockHeap();
 
     return 0;
+#endif
 }
 
 /*
@@ -133,19 +276,34 @@ ics_free(void *ptr)
 void*
 ics_realloc(void *ptr, size_t size)
 {
-    ics_free_header *oldBlock = NULL, *newBlock = NULL;
+    ics_free_header *newBlock = NULL;
     size_t oldPlayloadSize = 0;
     void *newPtr = NULL;
+    int8_t grown = -1, growable = -1;
 
     if(!ptr) return ics_malloc(size);
     if(size == 0) return ics_free(ptr), NULL;
 
-    oldBlock = GET_CURR_HEADER(ptr);
-    oldPlayloadSize = oldBlock->header.block_size - HEADER_SIZE - FOOTER_SIZE; // When copying the old data to the new memory block, only the payload part is to be copied, because the header and footer may be different in the new memory block.
+    // When copying the old data to the new memory block, only the payload part is to be copied, because the header and footer may be different in the new memory block.
+    if( !( oldPlayloadSize = ics_usable_size(ptr) ) ) return NULL;
 
     if(oldPlayloadSize == size) return ptr;
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+    if(size <= oldPlayloadSize && size > oldPlayloadSize / 2) return ptr;
+#else
+    // Staying within the block, or taking the free block behind it or new pages at the top of the heap, saves the copy.
+    if(size <= MAX_REQUEST_SIZE)
+    {
+        lockHeap();
+        grown = growBlock(GET_CURR_HEADER(ptr), CALC_ACTUAL_BLOCK_SIZE(size), size);
+        // A growable block that has to move to grow is placed as growable again.
+        if(grown != 1 && size > oldPlayloadSize) growable = isGrowableBlock(GET_CURR_HEADER(ptr), 1);
+        unlockHeap();
+        if(grown == 1) return ptr;
+    }
+#endif
 
-    if( (newBlock = ics_malloc(size)) == NULL ) return errno = ENOMEM, NULL;
+    if( (newBlock = ics_malloc_flags(size, growable == 1 ? ICS_GROWABLE : 0)) == NULL ) return errno = ENOMEM, NULL;
 
     if(oldPlayloadSize > size) memcpy(newBlock, ptr, size);
     else memcpy(newBlock, ptr, oldPlayloadSize);
@@ -154,4 +312,37 @@ ics_realloc(void *ptr, size_t size)
     ics_free(ptr);
 
     return newPtr;
-}
\ No newline at end of file
+}
+
+/*
+ * Returns the number of payload bytes usable through ptr, which may be more
+ * than was requested from ics_malloc.
+ *
+ * @param ptr Address of dynamically allocated memory returned by ics_malloc.
+ *
+ * @return The usable size, or 0 with errno set to EINVAL if ptr is not a valid
+ * allocated block (see ics_free).
+ */
+size_t
+ics_usable_size(void *ptr)
+{
+    ics_free_header *block = NULL;
+    int order = 0;
+
+    if(!ptr) return errno = EINVAL, 0;
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+    if( ( order = buddyBlockOrder(ptr) ) == -1 ) return errno = EINVAL, 0;
+    return 1UL << order;
+#else
+    block = GET_CURR_HEADER(ptr);
+#if ICS_THREAD_SAFE
+    if(isInHeap((char*)block) == -1) return findBlockOwner(block) ? GET_USABLE_SIZE(CLEAR_ALLOCATED_FLAG(block->header.block_size)) : (errno = EINVAL, 0);
+#endif
+    if(isInHeap((char*)block) == -1) return errno = EINVAL, 0;
+
+    if(isBlockValid(block, GET_CURR_FOOTER(block, CLEAR_ALLOCATED_FLAG(block->header.block_size))) == -1) return errno = EINVAL, 0;
+
+    return GET_USABLE_SIZE(CLEAR_ALLOCATED_FLAG(block->header.block_size));
+#endif
+}
@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include "helpers.h"
+#include "debug.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+#if ICS_NUMA
+/*
+ * Every thread heap lives on the node of the thread that created it: the
+ * reservation is bound to that node before any of it is touched, and blocks
+ * freed on other nodes go back to it through the remote free list. The
+ * counters in ics_heap show how often that locality is lost, either because a
+ * block crosses nodes to be freed or because its thread moved to another node
+ * and keeps allocating from the heap it left behind. A thread looks its node
+ * up again only every ICS_NUMA_NODE_REFRESH allocations, so a move shows in
+ * the counters with that delay.
+ */
+static unsigned int numaNodes = 0;
+static ICS_HEAP_LOCAL unsigned int threadNode = 0;
+static ICS_HEAP_LOCAL unsigned int nodeRefresh = 0;
+#endif
+
+
+/*
+ * Reports how well the thread heaps keep to their NUMA nodes.
+ *
+ * @param stats Filled with the number of nodes and thread heaps, the number of
+ * blocks freed by a thread other than their owner (remote_frees), how many of
+ * those were freed on another node than the heap is bound to
+ * (remote_node_frees), and the number of allocations made by a thread while it
+ * ran on another node than its heap (remote_node_allocs), as of the thread's
+ * last node lookup.
+ *
+ * @return 0 upon success, -1 if error and set errno accordingly.
+ *
+ * If stats is NULL or the allocator was built without ICS_NUMA, errno is set
+ * to EINVAL.
+ */
+int
+ics_get_numa_stats(ics_numa_stats *stats)
+{
+#if ICS_NUMA
+    unsigned int i = 0, count = __atomic_load_n(&heapCount, __ATOMIC_RELAXED);
+
+    if(!stats) return errno = EINVAL, -1;
+    if(count > ICS_MAX_HEAPS) count = ICS_MAX_HEAPS;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->nodes = numaNodeCount();
+
+    for(i = 0; i < count; ++i)
+    {
+        if(!__atomic_load_n(&heaps[i].base, __ATOMIC_ACQUIRE)) continue;
+
+        ++stats->heaps;
+        stats->remote_frees += __atomic_load_n(&heaps[i].remoteFreeCount, __ATOMIC_RELAXED);
+        stats->remote_node_frees += __atomic_load_n(&heaps[i].remoteNodeFrees, __ATOMIC_RELAXED);
+        stats->remote_node_allocs += __atomic_load_n(&heaps[i].remoteNodeAllocs, __ATOMIC_RELAXED);
+    }
+
+    return 0;
+#else
+    return errno = EINVAL, -1;
+#endif
+}
+
+#if ICS_NUMA
+unsigned int
+numaNodeCount()
+{
+    char online[64], *last = NULL;
+    ssize_t length = 0;
+    int fd = -1;
+
+    if(numaNodes) return numaNodes;
+
+    // The online node list reads like "0" or "0-1,3"; the last number is the highest node.
+    numaNodes = 1;
+    if( ( fd = open("/sys/devices/system/node/online", O_RDONLY) ) == -1 ) return numaNodes;
+    length = read(fd, online, sizeof(online) - 1);
+    close(fd);
+    if(length <= 0) return numaNodes;
+
+    online[length] = '\0';
+    for(last = online + length; last > online && (isdigit(last[-1]) || last[-1] == '\n'); --last);
+    numaNodes = strtoul(last, NULL, 10) + 1;
+    if(numaNodes > ICS_NUMA_MAX_NODES) numaNodes = ICS_NUMA_MAX_NODES;
+
+    return numaNodes;
+}
+
+unsigned int
+currentNode()
+{
+    unsigned int cpu = 0, node = 0;
+
+    if(getcpu(&cpu, &node) == -1) return 0;
+
+    // Nodes past the mask bindRegion can pass are treated as the last one it covers.
+    return node < ICS_NUMA_MAX_NODES ? node : ICS_NUMA_MAX_NODES - 1;
+}
+
+void
+bindRegion(char *base, size_t size, unsigned int node)
+{
+    unsigned long nodemask = 0;
+
+    // A single node machine has nothing to bind, every heap already is node-local.
+    if(numaNodeCount() == 1 || node >= ICS_NUMA_MAX_NODES) return;
+    nodemask = 1UL << node;
+
+    /*
+     * Preferred rather than strict binding: a full node spills to the others
+     * instead of failing. mbind reads maxnode - 1 bits of the mask, hence the + 1.
+     */
+    if(syscall(SYS_mbind, base, size, ICS_MPOL_PREFERRED, &nodemask, ICS_NUMA_MAX_NODES + 1, 0) == -1)
+        warn("could not bind heap at %p to node %u\n", (void*)base, node);
+}
+
+void
+checkHeapNode()
+{
+    if(nodeRefresh-- == 0)
+    {
+        threadNode = currentNode();
+        nodeRefresh = ICS_NUMA_NODE_REFRESH - 1;
+    }
+
+    if(threadNode != localHeap->node)
+        __atomic_store_n(&localHeap->remoteNodeAllocs, localHeap->remoteNodeAllocs + 1, __ATOMIC_RELAXED);
+}
+#endif
@@ -0,0 +1,264 @@
+#include "helpers.h"
+#include "debug.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#if ICS_PERSISTENT
+/*
+ * The heap file starts with one page holding an ics_persist_header, followed
+ * by the heap exactly as initHeap and extendHeap laid it out. Blocks only
+ * record their sizes, so the boundary tags survive a move to another address;
+ * pointer free-list links do not, so attachHeap rebuilds the free list while
+ * it checks every block, whatever the link encoding. persistHeader is NULL
+ * while no file is attached.
+ */
+ics_persist_header *persistHeader = NULL;
+
+static const ics_persist_header persistLayout = {
+    ICS_PERSIST_MAGIC, ICS_PERSIST_VERSION, ALIGNMENT, BLOCK_GRANULE, MIN_BLOCK_SIZE, HEAP_START_PAD, ICS_ENGINE, 0, 0, 0
+};
+#endif
+
+
+/*
+ * Backs the heap with a file, so it outlives the process. A new or empty file
+ * gets a new heap; a file written by an earlier run is mapped again, every
+ * block is checked and allocation continues where it stopped. Call it right
+ * after ics_mem_init() (and ics_mem_tune(), which sets the reservation of a
+ * new heap file), before the first allocation.
+ *
+ * @param path The heap file, created if it does not exist.
+ * @param base Page-aligned address the heap starts at, the same in every run,
+ * or NULL to let the system pick one. Pointers stored inside the heap only
+ * stay valid when it is mapped at the same base again; ics_get_root() works
+ * at any base.
+ *
+ * @return 1 if an existing heap was attached, 0 if a new one was created, -1
+ * if error and set errno accordingly.
+ *
+ * If path is NULL, the heap is already in use or the allocator was built
+ * without ICS_PERSISTENT, errno is set to EINVAL; EINVAL is also used for a
+ * file written by a build with another block layout. A heap that fails the
+ * consistency check, as one left behind by a crash in the middle of
+ * ics_malloc or ics_free can, sets errno to EIO. If base is given but not
+ * free, errno is set to EEXIST. Otherwise errno is left as set by open(2),
+ * ftruncate(2) or mmap(2).
+ */
+int
+ics_mem_attach(const char *path, void *base)
+{
+#if ICS_PERSISTENT
+    char *heapStart = NULL;
+    size_t reserve = 0, used = 0, committed = 0;
+    int fd = -1, error = 0;
+
+    if(!path || pagesCount || persistHeader) return errno = EINVAL, -1;
+    if( ( fd = openHeapFile(path, &reserve, &used, &committed) ) == -1 ) return -1;
+
+    if( !( heapStart = mapRegionFile(fd, base, &reserve, used, committed) ) )
+    {
+        error = errno;
+        close(fd);
+        return errno = error, -1;
+    }
+
+    persistHeader = (ics_persist_header*)(heapStart - PAGE_SIZE);
+    if(!used)
+    {
+        *persistHeader = persistLayout;
+        persistHeader->reserve_size = reserve;
+        return 0;
+    }
+
+    pagesCount = used / PAGE_SIZE;
+    prologue = (ics_header*)(heapStart + HEAP_START_PAD);
+    if(attachHeap() == -1)
+    {
+        ics_mem_detach();
+        return errno = EIO, -1;
+    }
+
+    return 1;
+#else
+    return errno = EINVAL, -1;
+#endif
+}
+
+/*
+ * Writes the attached heap file back to disk and unmaps it. Every pointer into
+ * the heap becomes invalid; the next allocation starts a new anonymous heap
+ * unless another file is attached first.
+ *
+ * @return 0 upon success, -1 if error and set errno accordingly.
+ *
+ * If no heap file is attached, errno is set to EINVAL. If writing the file
+ * back fails, errno is left as set by msync(2) and the heap is detached all
+ * the same.
+ */
+int
+ics_mem_detach()
+{
+#if ICS_PERSISTENT
+    if(!persistHeader) return errno = EINVAL, -1;
+
+    persistHeader = NULL;
+    pagesCount = 0;
+    prologue = NULL;
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    tlsfClear();
+#else
+    freelist_head = NULL;
+    freelist_next = NULL;
+#endif
+
+    return unmapRegionFile() == -1 ? -1 : 0;
+#else
+    return errno = EINVAL, -1;
+#endif
+}
+
+/*
+ * Records the block a later run starts from, typically the root of an index
+ * built in the heap. It is stored as an offset in the heap file.
+ *
+ * @param ptr Address returned by ics_malloc, or NULL to clear the root.
+ *
+ * @return 0 upon success, -1 if error and set errno accordingly.
+ *
+ * If no heap file is attached or ptr is not in the heap, errno is set to
+ * EINVAL.
+ */
+int
+ics_set_root(void *ptr)
+{
+#if ICS_PERSISTENT
+    if(!persistHeader || (ptr && isInHeap((char*)GET_CURR_HEADER(ptr)) == -1)) return errno = EINVAL, -1;
+
+    persistHeader->root = ptr ? (char*)ptr - ((char*)persistHeader + PAGE_SIZE) + 1 : 0;
+
+    return 0;
+#else
+    return errno = EINVAL, -1;
+#endif
+}
+
+/*
+ * Returns the block recorded by ics_set_root, at its address in this run.
+ *
+ * @return The root, or NULL if none was set or no heap file is attached.
+ */
+void*
+ics_get_root()
+{
+#if ICS_PERSISTENT
+    if(!persistHeader || !persistHeader->root) return NULL;
+
+    return (char*)persistHeader + PAGE_SIZE + persistHeader->root - 1;
+#else
+    return NULL;
+#endif
+}
+
+#if ICS_PERSISTENT
+int
+openHeapFile(const char *path, size_t *reserve, size_t *used, size_t *committed)
+{
+    ics_persist_header header;
+    struct stat status;
+    int fd = -1, error = 0;
+
+    if( ( fd = open(path, O_RDWR | O_CREAT, 0600) ) == -1 ) return -1;
+    if(fstat(fd, &status) == -1) error = errno;
+
+    // An empty file becomes a new heap: just the header page, nothing committed yet.
+    if(!error && status.st_size == 0)
+    {
+        if(ftruncate(fd, PAGE_SIZE) == -1) error = errno;
+        *reserve = *used = *committed = 0;
+        if(!error) return fd;
+    }
+
+    // A file cut short inside its header page cannot hold a heap.
+    if(!error && status.st_size < PAGE_SIZE) error = EIO;
+    if( !error &&
+        ( pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+          memcmp(&header, &persistLayout, offsetof(ics_persist_header, reserve_size)) ) )
+    {
+        error = EINVAL;
+    }
+    if(!error)
+    {
+        *reserve = header.reserve_size;
+        *used = header.pages * PAGE_SIZE;
+        *committed = status.st_size - PAGE_SIZE;
+        if(*used > *reserve || *committed < *used || *committed > *reserve) error = EIO;
+    }
+
+    if(!error) return fd;
+
+    close(fd);
+    return errno = error, -1;
+}
+
+int8_t
+attachHeap()
+{
+    ics_free_header *block = (ics_free_header*)((char*)prologue + PROLOGUE_SIZE), *tail = NULL;
+    ics_footer *footer = NULL, *epilogue = GET_EPILOGUE_ADDR(getHeapBrk());
+    size_t blockSize = 0, prevFreeSize = 0;
+
+    if( prologue->hid != HEADER_MAGIC || prologue->block_size != SET_ALLOCATED_FLAG(0) || prologue->requested_size ||
+        epilogue->fid != FOOTER_MAGIC || epilogue->block_size != SET_ALLOCATED_FLAG(0) || epilogue->requested_size )
+    {
+        return -1;
+    }
+
+    // Walk the blocks by their sizes, checking both tags, and thread the free ones back together in address order.
+    for(; (char*)block < (char*)epilogue; block = GET_NEXT_HEADER(block, blockSize))
+    {
+        blockSize = CLEAR_ALLOCATED_FLAG(block->header.block_size);
+        if( blockSize < MIN_BLOCK_SIZE || blockSize % BLOCK_GRANULE ||
+            blockSize > (size_t)((char*)epilogue - (char*)block) )
+        {
+            return -1;
+        }
+
+        footer = GET_CURR_FOOTER(block, blockSize);
+        if( block->header.hid != HEADER_MAGIC || footer->fid != FOOTER_MAGIC ||
+            block->header.block_size != footer->block_size ||
+            block->header.requested_size != footer->requested_size )
+        {
+            return -1;
+        }
+
+        if(block->header.block_size & 0x1)
+        {
+            if(!block->header.requested_size || block->header.requested_size > GET_USABLE_SIZE(blockSize)) return -1;
+            prevFreeSize = 0;
+            continue;
+        }
+
+        // Free neighbours are always coalesced unless the merged block would be too large.
+        if(block->header.requested_size || (prevFreeSize && prevFreeSize + blockSize <= MAX_BLOCK_SIZE)) return -1;
+        prevFreeSize = blockSize;
+
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+        tlsfInsert(block);
+#else
+        SET_PREV_FREE(block, tail);
+        SET_NEXT_FREE(block, NULL);
+        if(tail) SET_NEXT_FREE(tail, block);
+        else freelist_head = block;
+        tail = block;
+#endif
+    }
+    if((char*)block != (char*)epilogue) return -1;
+
+    freelist_next = freelist_head;
+
+    return 1;
+}
+#endif
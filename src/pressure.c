@@ -0,0 +1,74 @@
+#include "helpers.h"
+#include "debug.h"
+
+
+/*
+ * Heap limits in bytes, 0 meaning no limit. incHeapBrk refuses to grow past
+ * heapHardLimit and raises softLimitCrossed when it grows past heapSoftLimit;
+ * ics_malloc reports that to the handler once the allocation is complete.
+ */
+size_t heapSoftLimit = 0;
+size_t heapHardLimit = 0;
+ICS_HEAP_LOCAL int8_t softLimitCrossed = 0;
+
+static ics_pressure_handler pressureHandler = NULL;
+static void *pressureArg = NULL;
+static ICS_HEAP_LOCAL int8_t inPressureHandler = 0;
+
+
+/*
+ * Registers the function called when the heap runs short of memory. The
+ * handler gets the pressure level, the current heap size in bytes, the size of
+ * the request that triggered it and arg. It is called with ICS_PRESSURE_SOFT
+ * once the heap grows past the soft limit, and with ICS_PRESSURE_HARD before
+ * ics_malloc would fail with ENOMEM. It may call ics_free and ics_malloc, and
+ * for ICS_PRESSURE_HARD returns non-zero after releasing memory to have the
+ * allocation retried, 0 to let it fail.
+ *
+ * @param handler The callback, or NULL to remove the current one.
+ * @param arg Passed to every call of handler.
+ */
+void
+ics_set_pressure_handler(ics_pressure_handler handler, void *arg)
+{
+    pressureHandler = handler;
+    pressureArg = arg;
+}
+
+/*
+ * Sets the soft and hard limit on the bytes the heap takes from the system.
+ * The heap never grows past the hard limit, so ics_malloc fails with ENOMEM
+ * once it is reached even if MAX_PAGES or the reservation would allow more.
+ *
+ * @param soft_limit Heap size that triggers ICS_PRESSURE_SOFT, 0 for none.
+ * @param hard_limit Largest heap size, 0 for none.
+ *
+ * @return 0 upon success, -1 and errno set to EINVAL if both limits are set
+ * and soft_limit is larger than hard_limit.
+ */
+int
+ics_set_heap_limits(size_t soft_limit, size_t hard_limit)
+{
+    if(soft_limit && hard_limit && soft_limit > hard_limit) return errno = EINVAL, -1;
+
+    heapSoftLimit = soft_limit;
+    heapHardLimit = hard_limit;
+
+    return 0;
+}
+
+int8_t
+notifyPressure(int level, size_t requestedSize)
+{
+    int release = 0;
+
+    if(level == ICS_PRESSURE_SOFT) softLimitCrossed = 0;
+    if(!pressureHandler || inPressureHandler) return -1;
+
+    // Allocations made by the handler itself fail without calling it again.
+    inPressureHandler = 1;
+    release = pressureHandler(level, (size_t)pagesCount * PAGE_SIZE, requestedSize, pressureArg);
+    inPressureHandler = 0;
+
+    return release ? 1 : -1;
+}
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include "helpers.h"
+#include "debug.h"
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/*
+ * Bytes left until the next sampled allocation. ics_malloc subtracts every
+ * request from it and only calls profileSample once it drops below zero.
+ */
+int64_t profileCountdown = INT64_MAX;
+
+/*
+ * Number of live entries in the sample table, checked by ics_free before
+ * paying for a lookup.
+ */
+unsigned int profileLive = 0;
+
+static size_t profileInterval = 0;
+static uint64_t profileSeed = 0x9e3779b97f4a7c15ULL;
+static ics_profile_sample profileTable[ICS_PROFILE_SLOTS];
+
+
+/*
+ * Sets the mean number of allocated bytes between two sampled allocations.
+ * Each sample records the backtrace of its ics_malloc call in a side table
+ * keyed by the returned pointer; ics_free drops the entry again.
+ *
+ * @param bytes The sampling interval. 0 disables sampling, intervals above
+ * MAX_PROFILE_INTERVAL are cut to it.
+ */
+void
+ics_profile_set_interval(size_t bytes)
+{
+    profileInterval = bytes < MAX_PROFILE_INTERVAL ? bytes : MAX_PROFILE_INTERVAL;
+    profileCountdown = bytes ? nextSampleDistance() : INT64_MAX;
+}
+
+/*
+ * Writes every live sampled allocation to fd.
+ *
+ * @param fd Open file descriptor the profile is written to.
+ * @param format ICS_PROFILE_PPROF for the pprof legacy heap_v2 text format,
+ * ICS_PROFILE_COLLAPSED for one "root;...;leaf bytes" line per sample.
+ *
+ * @return 0 upon success, -1 and errno set to EINVAL if fd or format is invalid.
+ */
+int
+ics_profile_dump(int fd, int format)
+{
+    size_t liveBytes = 0, i = 0;
+
+    if(fd < 0 || (format != ICS_PROFILE_PPROF && format != ICS_PROFILE_COLLAPSED))
+        return errno = EINVAL, -1;
+
+    if(format == ICS_PROFILE_COLLAPSED)
+    {
+        for(i = 0; i < ICS_PROFILE_SLOTS; ++i)
+        {
+            if(profileTable[i].ptr) writeCollapsedSample(fd, &profileTable[i]);
+        }
+        return 0;
+    }
+
+    for(i = 0; i < ICS_PROFILE_SLOTS; ++i)
+    {
+        if(profileTable[i].ptr) liveBytes += profileTable[i].size;
+    }
+
+    dprintf(fd, "heap profile: %u: %zu [%u: %zu] @ heap_v2/%zu\n",
+            profileLive, liveBytes, profileLive, liveBytes, profileInterval);
+
+    for(i = 0; i < ICS_PROFILE_SLOTS; ++i)
+    {
+        if(profileTable[i].ptr) writePprofSample(fd, &profileTable[i]);
+    }
+
+    writeMappedLibraries(fd);
+
+    return 0;
+}
+
+int64_t
+nextSampleDistance()
+{
+    profileSeed ^= profileSeed << 13;
+    profileSeed ^= profileSeed >> 7;
+    profileSeed ^= profileSeed << 17;
+
+    return (int64_t)(1 + profileSeed % (profileInterval << 1));
+}
+
+void
+profileSample(void *ptr, size_t size)
+{
+    void *frames[ICS_PROFILE_MAX_DEPTH + ICS_PROFILE_SKIP_FRAMES];
+    ics_profile_sample *slot = NULL;
+    int depth = 0;
+
+    if(!profileInterval)
+    {
+        profileCountdown = INT64_MAX;
+        return;
+    }
+    profileCountdown = nextSampleDistance();
+
+    if( !( slot = findProfileSlot(ptr, 1) ) ) return;
+
+    depth = backtrace(frames, ICS_PROFILE_MAX_DEPTH + ICS_PROFILE_SKIP_FRAMES) - ICS_PROFILE_SKIP_FRAMES;
+    if(depth < 0) depth = 0;
+
+    slot->ptr = ptr;
+    slot->size = size;
+    slot->depth = depth;
+    memcpy(slot->stack, frames + ICS_PROFILE_SKIP_FRAMES, depth * sizeof(void*));
+    ++profileLive;
+}
+
+void
+profileRemove(void *ptr)
+{
+    ics_profile_sample *slot = findProfileSlot(ptr, 0);
+    size_t hole = 0, i = 0, home = 0;
+
+    if(!slot) return;
+
+    slot->ptr = NULL;
+    --profileLive;
+
+    // Backward-shift deletion keeps the linear probe chains intact without tombstones.
+    hole = slot - profileTable;
+    i = hole;
+    while(1)
+    {
+        i = (i + 1) & (ICS_PROFILE_SLOTS - 1);
+        if(!profileTable[i].ptr) return;
+
+        home = PROFILE_HASH(profileTable[i].ptr);
+        if( ((i - home) & (ICS_PROFILE_SLOTS - 1)) >= ((i - hole) & (ICS_PROFILE_SLOTS - 1)) )
+        {
+            profileTable[hole] = profileTable[i];
+            profileTable[i].ptr = NULL;
+            hole = i;
+        }
+    }
+}
+
+ics_profile_sample*
+findProfileSlot(void *ptr, int8_t forInsert)
+{
+    size_t i = PROFILE_HASH(ptr), probes = 0;
+
+    for(probes = 0; probes < ICS_PROFILE_SLOTS; ++probes)
+    {
+        if(profileTable[i].ptr == ptr) return &profileTable[i];
+        if(!profileTable[i].ptr) return forInsert ? &profileTable[i] : NULL;
+        i = (i + 1) & (ICS_PROFILE_SLOTS - 1);
+    }
+
+    return NULL;
+}
+
+void
+writePprofSample(int fd, ics_profile_sample *sample)
+{
+    unsigned int i = 0;
+
+    dprintf(fd, "1: %zu [1: %zu] @", sample->size, sample->size);
+    for(i = 0; i < sample->depth; ++i)
+    {
+        dprintf(fd, " %p", sample->stack[i]);
+    }
+    dprintf(fd, "\n");
+}
+
+void
+writeCollapsedSample(int fd, ics_profile_sample *sample)
+{
+    Dl_info info;
+    int i = 0;
+
+    for(i = (int)sample->depth - 1; i >= 0; --i)
+    {
+        if( dladdr(sample->stack[i], &info) && info.dli_sname )
+            dprintf(fd, "%s", info.dli_sname);
+        else
+            dprintf(fd, "%p", sample->stack[i]);
+
+        if(i) dprintf(fd, ";");
+    }
+    dprintf(fd, " %zu\n", sample->size);
+}
+
+void
+writeMappedLibraries(int fd)
+{
+    char buffer[PAGE_SIZE];
+    ssize_t bytesRead = 0;
+    int mapsFd = open("/proc/self/maps", O_RDONLY);
+
+    dprintf(fd, "\nMAPPED_LIBRARIES:\n");
+    if(mapsFd == -1) return;
+
+    while( ( bytesRead = read(mapsFd, buffer, sizeof(buffer)) ) > 0 )
+    {
+        if(write(fd, buffer, bytesRead) != bytesRead) break;
+    }
+
+    close(mapsFd);
+}
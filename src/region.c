@@ -0,0 +1,279 @@
+#include "helpers.h"
+#include "debug.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+#if ICS_REGION_RESERVE
+/*
+ * The heap lives in [regionBase, regionBrk). Pages up to regionCommitted are
+ * readable and writable, the rest of the reservation up to regionLimit is
+ * PROT_NONE address space that costs nothing until it is committed. Every
+ * commit is growthFactor times larger than the previous one, so moving the
+ * break is a pointer bump except for a logarithmic number of mprotect calls.
+ */
+static ICS_HEAP_LOCAL char *regionBase = NULL;
+static ICS_HEAP_LOCAL char *regionBrk = NULL;
+static ICS_HEAP_LOCAL char *regionCommitted = NULL;
+static ICS_HEAP_LOCAL char *regionLimit = NULL;
+static ICS_HEAP_LOCAL size_t commitChunk = ICS_COMMIT_CHUNK;
+static ICS_HEAP_LOCAL int8_t hugePages = ICS_HUGEPAGES;
+
+// Set by ics_mem_tune for every heap reserved afterwards, in any thread.
+static size_t reserveSize = ICS_RESERVE_SIZE;
+static unsigned int growthFactor = ICS_GROWTH_FACTOR;
+#endif
+
+#if ICS_PERSISTENT
+/*
+ * With a heap file attached, the reservation is a shared mapping of the file
+ * one page past its header, and committing means growing the file: pages past
+ * its end are mapped but must not be touched.
+ */
+static int regionFd = -1;
+#endif
+
+
+/*
+ * Tunes how the heap reserves and commits memory. Call it together with
+ * ics_mem_init(), before the first allocation. With ICS_THREAD_SAFE the
+ * settings apply to the heaps of all threads, so call it before any thread
+ * allocates.
+ *
+ * @param reserve_size Bytes of address space to reserve for the heap. Rounded
+ * up to the commit granularity.
+ * @param growth_factor Each commit is this many times larger than the previous
+ * one, up to the rest of the reservation. 1 commits ICS_COMMIT_CHUNK bytes
+ * every time.
+ *
+ * @return 0 upon success, -1 if error and set errno accordingly.
+ *
+ * If the heap is already in use, growth_factor is 0 or above
+ * MAX_GROWTH_FACTOR, reserve_size is 0, cannot be rounded up or is beyond the
+ * 4 GiB that ICS_COMPACT_LINKS can address, or the allocator was built without
+ * ICS_REGION_RESERVE, errno is set to EINVAL.
+ */
+int
+ics_mem_tune(size_t reserve_size, unsigned int growth_factor)
+{
+#if ICS_REGION_RESERVE
+#if ICS_THREAD_SAFE
+    if(__atomic_load_n(&heapCount, __ATOMIC_ACQUIRE)) return errno = EINVAL, -1;
+#endif
+    if(regionBase || !reserve_size || !growth_factor || growth_factor > MAX_GROWTH_FACTOR) return errno = EINVAL, -1;
+    if(reserve_size > SIZE_MAX - ICS_COMMIT_CHUNK) return errno = EINVAL, -1;
+    if(ICS_COMPACT_LINKS && reserve_size > (1UL << 32)) return errno = EINVAL, -1;
+
+    reserveSize = ROUND_UP(reserve_size, ICS_COMMIT_CHUNK);
+    growthFactor = growth_factor;
+
+    return 0;
+#else
+    return errno = EINVAL, -1;
+#endif
+}
+
+void*
+getHeapBrk()
+{
+#if ICS_REGION_RESERVE
+    return regionBrk;
+#else
+    return ics_get_brk();
+#endif
+}
+
+void*
+incHeapBrk(size_t pages)
+{
+    char *oldBrk = NULL;
+    size_t i = 0;
+
+    if(heapHardLimit && (pagesCount + pages) * PAGE_SIZE > heapHardLimit) return (void*)-1;
+
+#if ICS_REGION_RESERVE
+    if(!regionBase && reserveRegion() == -1) return (void*)-1;
+    if(pages > (size_t)(regionLimit - regionBrk) / PAGE_SIZE) return (void*)-1;
+
+    while(regionBrk + pages * PAGE_SIZE > regionCommitted)
+    {
+        if(commitRegion() == -1) return (void*)-1;
+    }
+
+    oldBrk = regionBrk;
+    regionBrk += pages * PAGE_SIZE;
+#if ICS_THREAD_SAFE
+    __atomic_store_n(&localHeap->brk, regionBrk, __ATOMIC_RELEASE);
+#endif
+#else
+    if(pagesCount + pages > MAX_PAGES) return (void*)-1;
+    if( ( oldBrk = ics_inc_brk() ) == (void*)-1 ) return (void*)-1;
+
+    for(i = 1; i < pages; ++i)
+    {
+        if(ics_inc_brk() == (void*)-1) return (void*)-1;
+    }
+#endif
+
+    pagesCount += pages;
+#if ICS_PERSISTENT
+    if(persistHeader) persistHeader->pages = pagesCount;
+#endif
+    if( heapSoftLimit &&
+        (size_t)pagesCount * PAGE_SIZE >= heapSoftLimit &&
+        (size_t)(pagesCount - pages) * PAGE_SIZE < heapSoftLimit )
+    {
+        softLimitCrossed = 1;
+    }
+
+    return oldBrk;
+}
+
+size_t
+heapPagesLeft()
+{
+    size_t pages = 0;
+
+#if ICS_REGION_RESERVE
+    pages = ( regionBase ? (size_t)(regionLimit - regionBrk) : reserveSize ) / PAGE_SIZE;
+#else
+    pages = MAX_PAGES - pagesCount;
+#endif
+    if(heapHardLimit && pagesCount + pages > heapHardLimit / PAGE_SIZE)
+        pages = pagesCount < heapHardLimit / PAGE_SIZE ? heapHardLimit / PAGE_SIZE - pagesCount : 0;
+
+    return pages;
+}
+
+#if ICS_THREAD_SAFE
+void
+saveRegionState(ics_heap_state *state)
+{
+    state->regionBase = regionBase;
+    state->regionBrk = regionBrk;
+    state->regionCommitted = regionCommitted;
+    state->regionLimit = regionLimit;
+    state->commitChunk = commitChunk;
+    state->hugePages = hugePages;
+}
+
+void
+loadRegionState(const ics_heap_state *state)
+{
+    regionBase = state->regionBase;
+    regionBrk = state->regionBrk;
+    regionCommitted = state->regionCommitted;
+    regionLimit = state->regionLimit;
+    commitChunk = state->commitChunk;
+    hugePages = state->hugePages;
+}
+#endif
+
+#if ICS_REGION_RESERVE
+int8_t
+reserveRegion()
+{
+    size_t alignment = ICS_HUGEPAGES ? HUGE_PAGE_SIZE : PAGE_SIZE;
+    char *mapping = NULL;
+
+    // Over-reserve by one alignment unit so the heap can start on a huge page boundary.
+    mapping = mmap(NULL, reserveSize + alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(mapping == MAP_FAILED) return -1;
+
+    regionBase = (char*)ROUND_UP((uintptr_t)mapping, alignment);
+    regionBrk = regionBase;
+    regionCommitted = regionBase;
+    regionLimit = regionBase + reserveSize;
+
+#if ICS_THREAD_SAFE
+    if( !( localHeap = registerHeap(regionBase, reserveSize) ) )
+    {
+        munmap(mapping, reserveSize + alignment);
+        regionBase = NULL;
+        return -1;
+    }
+#endif
+
+    return 1;
+}
+
+int8_t
+commitRegion()
+{
+    size_t length = commitChunk;
+
+    if(length > (size_t)(regionLimit - regionCommitted)) length = regionLimit - regionCommitted;
+    if(!length) return -1;
+#if ICS_PERSISTENT
+    if(regionFd != -1)
+    {
+        if(ftruncate(regionFd, PAGE_SIZE + (regionCommitted - regionBase) + length) == -1) return -1;
+    }
+    else
+#endif
+    if(mprotect(regionCommitted, length, PROT_READ | PROT_WRITE) == -1) return -1;
+
+#if ICS_HUGEPAGES
+    // Without THP support the memory is still usable as 4 KiB pages.
+    if(hugePages && madvise(regionCommitted, length, MADV_HUGEPAGE) == -1)
+    {
+        warn("transparent huge pages unavailable, falling back to %d byte pages\n", PAGE_SIZE);
+        hugePages = 0;
+    }
+#endif
+
+    regionCommitted += length;
+    // No commit is larger than what is left, so the chunk cannot overflow.
+    length = regionLimit - regionCommitted;
+    commitChunk = commitChunk > length / growthFactor ? length : commitChunk * growthFactor;
+
+    return 1;
+}
+#endif
+
+#if ICS_PERSISTENT
+char*
+mapRegionFile(int fd, char *base, size_t *reserve, size_t used, size_t committed)
+{
+    char *mapping = NULL, *hint = base ? base - PAGE_SIZE : NULL;
+
+    if(!*reserve) *reserve = reserveSize;
+
+    // A fixed base must be free: MAP_FIXED_NOREPLACE fails instead of replacing another mapping.
+    mapping = mmap(hint, PAGE_SIZE + *reserve, PROT_READ | PROT_WRITE, MAP_SHARED | (base ? MAP_FIXED_NOREPLACE : 0), fd, 0);
+    if(mapping == MAP_FAILED) return NULL;
+    if(hint && mapping != hint)
+    {
+        munmap(mapping, PAGE_SIZE + *reserve);
+        errno = EEXIST;
+        return NULL;
+    }
+
+    regionFd = fd;
+    reserveSize = *reserve;
+    regionBase = mapping + PAGE_SIZE;
+    regionBrk = regionBase + used;
+    regionCommitted = regionBase + committed;
+    regionLimit = regionBase + reserveSize;
+
+    return regionBase;
+}
+
+int8_t
+unmapRegionFile()
+{
+    int8_t result = 1;
+
+    if(regionFd == -1) return -1;
+
+    if(msync(regionBase - PAGE_SIZE, PAGE_SIZE + (regionCommitted - regionBase), MS_SYNC) == -1) result = -1;
+    munmap(regionBase - PAGE_SIZE, PAGE_SIZE + reserveSize);
+    close(regionFd);
+
+    regionFd = -1;
+    regionBase = regionBrk = regionCommitted = regionLimit = NULL;
+    commitChunk = ICS_COMMIT_CHUNK;
+
+    return result;
+}
+#endif
@@ -0,0 +1,217 @@
+#include "helpers.h"
+#include "debug.h"
+
+
+#if ICS_THREAD_SAFE
+/*
+ * Registry of the thread heaps. Entries are only ever appended: a thread takes
+ * a slot under heapRegistryLock and publishes its base last, so other threads
+ * can look up the owner of a block without a lock. When a thread exits, the
+ * destructor of heapKey saves its heap variables in the entry and marks it
+ * orphaned; the next thread that needs a heap adopts it, with the blocks the
+ * old owner left and the remote frees queued since, instead of taking a slot. A block freed by a
+ * thread other than its owner is pushed onto the owner's remoteFrees list by
+ * compare-and-swap, reusing the first payload word as the link; the owner
+ * swaps the whole list out and frees it locally on its next ics_malloc. A
+ * queued block keeps its allocated bit but has requested_size cleared in its
+ * header, so a second ics_free of it is refused until the owner releases it.
+ */
+ics_heap heaps[ICS_MAX_HEAPS];
+unsigned int heapCount = 0;
+pthread_mutex_t heapRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+static int8_t forkHandlersInstalled = 0;
+static pthread_key_t heapKey;
+static int8_t heapKeyCreated = 0;
+
+// The variables of a thread without a heap.
+static const ics_heap_state freshState = {
+    NULL, NULL, NULL, 0, 0, NULL, NULL, NULL, NULL, ICS_COMMIT_CHUNK, ICS_HUGEPAGES
+};
+
+ICS_HEAP_LOCAL ics_heap *localHeap = NULL;
+
+
+ics_heap*
+registerHeap(char *base, size_t size)
+{
+    unsigned int slot = 0;
+
+    pthread_mutex_lock(&heapRegistryLock);
+    if(!forkHandlersInstalled && pthread_atfork(prepareFork, resumeForkParent, resumeForkChild) == 0)
+        forkHandlersInstalled = 1;
+    if(!heapKeyCreated && pthread_key_create(&heapKey, orphanHeap) == 0)
+        heapKeyCreated = 1;
+
+    if( ( slot = heapCount ) >= ICS_MAX_HEAPS )
+    {
+        pthread_mutex_unlock(&heapRegistryLock);
+        return NULL;
+    }
+
+    heaps[slot].brk = base;
+    heaps[slot].remoteFrees = NULL;
+    heaps[slot].orphaned = 0;
+    pthread_mutex_init(&heaps[slot].lock, NULL);
+#if ICS_NUMA
+    heaps[slot].node = currentNode();
+    bindRegion(base, size, heaps[slot].node);
+#endif
+    __atomic_store_n(&heaps[slot].base, base, __ATOMIC_RELEASE);
+    __atomic_store_n(&heapCount, slot + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&heapRegistryLock);
+    if(heapKeyCreated) pthread_setspecific(heapKey, &heaps[slot]);
+
+    return &heaps[slot];
+}
+
+void
+orphanHeap(void *heap)
+{
+    ics_heap *orphan = heap;
+
+    // The lock keeps a fork from copying the heap halfway through.
+    pthread_mutex_lock(&orphan->lock);
+    saveHeapState(&orphan->state);
+    pthread_mutex_unlock(&orphan->lock);
+
+    // An allocation by a later destructor of this thread starts from scratch.
+    loadHeapState(&freshState);
+    localHeap = NULL;
+
+    pthread_mutex_lock(&heapRegistryLock);
+    orphan->orphaned = 1;
+    pthread_mutex_unlock(&heapRegistryLock);
+}
+
+int8_t
+adoptHeap()
+{
+    unsigned int i = 0, count = 0;
+    ics_heap *heap = NULL;
+
+    pthread_mutex_lock(&heapRegistryLock);
+    count = heapCount > ICS_MAX_HEAPS ? ICS_MAX_HEAPS : heapCount;
+    for(i = 0; i < count && !heap; ++i)
+    {
+        if(heaps[i].orphaned) heap = &heaps[i];
+    }
+    if(heap) heap->orphaned = 0;
+    pthread_mutex_unlock(&heapRegistryLock);
+
+    if(!heap) return -1;
+
+    // The remote frees queued meanwhile are drained by the ics_malloc that called initHeap.
+    loadHeapState(&heap->state);
+    localHeap = heap;
+    pthread_setspecific(heapKey, heap);
+
+    return 1;
+}
+
+void
+saveHeapState(ics_heap_state *state)
+{
+    state->freelistHead = freelist_head;
+    state->freelistNext = freelist_next;
+    state->prologueHeader = prologue;
+    state->pages = pagesCount;
+    state->softLimitCrossed = softLimitCrossed;
+    saveRegionState(state);
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    saveTlsfState(state);
+#endif
+}
+
+void
+loadHeapState(const ics_heap_state *state)
+{
+    freelist_head = state->freelistHead;
+    freelist_next = state->freelistNext;
+    prologue = state->prologueHeader;
+    pagesCount = state->pages;
+    softLimitCrossed = state->softLimitCrossed;
+    loadRegionState(state);
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+    loadTlsfState(state);
+#endif
+}
+
+ics_heap*
+findHeap(char *block)
+{
+    unsigned int i = 0, count = __atomic_load_n(&heapCount, __ATOMIC_RELAXED);
+    char *base = NULL;
+
+    if(count > ICS_MAX_HEAPS) count = ICS_MAX_HEAPS;
+
+    for(i = 0; i < count; ++i)
+    {
+        if( ( base = __atomic_load_n(&heaps[i].base, __ATOMIC_ACQUIRE) ) &&
+            block >= base + HEAP_START_PAD + PROLOGUE_SIZE &&
+            block < __atomic_load_n(&heaps[i].brk, __ATOMIC_ACQUIRE) - EPILOGUE_SIZE )
+        {
+            return &heaps[i];
+        }
+    }
+
+    return NULL;
+}
+
+ics_heap*
+findBlockOwner(ics_free_header *block)
+{
+    ics_heap *heap = NULL;
+    ics_footer *footer = NULL;
+
+    if( !( heap = findHeap((char*)block) ) ) return NULL;
+
+    footer = GET_CURR_FOOTER(block, CLEAR_ALLOCATED_FLAG(block->header.block_size));
+    if(findHeap((char*)footer) != heap || hasValidTags(block, footer) == -1) return NULL;
+
+    return heap;
+}
+
+int
+freeRemoteBlock(ics_free_header *block)
+{
+    ics_heap *heap = NULL;
+    ics_free_header *head = NULL;
+    ics_header header;
+    uint64_t seen = 0, queued = 0;
+
+    if( !( heap = findBlockOwner(block) ) ) return errno = EINVAL, -1;
+
+    // Clearing requested_size marks the block as queued, so freeing it again fails the tag check until it is drained.
+    seen = __atomic_load_n((uint64_t*)&block->header, __ATOMIC_RELAXED);
+    memcpy(&header, &seen, sizeof(header));
+    if(!header.requested_size) return errno = EINVAL, -1;
+    header.requested_size = 0;
+    memcpy(&queued, &header, sizeof(queued));
+    if(!__atomic_compare_exchange_n((uint64_t*)&block->header, &seen, queued, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return errno = EINVAL, -1;
+#if ICS_NUMA
+    __atomic_fetch_add(&heap->remoteFreeCount, 1, __ATOMIC_RELAXED);
+    if(currentNode() != heap->node) __atomic_fetch_add(&heap->remoteNodeFrees, 1, __ATOMIC_RELAXED);
+#endif
+
+    head = __atomic_load_n(&heap->remoteFrees, __ATOMIC_RELAXED);
+    do
+    {
+        REMOTE_NEXT(block) = head;
+    } while(!__atomic_compare_exchange_n(&heap->remoteFrees, &head, block, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+void
+drainRemoteFrees()
+{
+    ics_free_header *block = __atomic_exchange_n(&localHeap->remoteFrees, NULL, __ATOMIC_ACQUIRE), *next = NULL;
+
+    for(; block; block = next)
+    {
+        next = REMOTE_NEXT(block);
+        releaseBlock(block, GET_CURR_FOOTER(block, CLEAR_ALLOCATED_FLAG(block->header.block_size)));
+    }
+}
+#endif
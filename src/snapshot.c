@@ -0,0 +1,102 @@
+#include "helpers.h"
+#include "debug.h"
+#include <unistd.h>
+
+
+/*
+ * Writes a binary map of the heap to fd: one ics_snapshot_header followed by
+ * one ics_snapshot_block per block between the prologue and the epilogue, in
+ * address order. The format is read by tools/heapsnap.c. Blocks queued on the
+ * remote free list of the heap are still allocated until their owner drains
+ * them. Under ICS_SIZE_CLASSES allocated blocks are counted in the learned
+ * class their request was rounded to.
+ *
+ * @param fd Open file descriptor the snapshot is written to.
+ *
+ * @return 0 upon success, -1 if error and set errno accordingly.
+ *
+ * If fd is invalid, this function sets errno to EINVAL. If writing fails, errno
+ * is left as set by write(2). Buddy blocks have no headers to map, so under
+ * ICS_ENGINE_BUDDY errno is set to ENOTSUP.
+ */
+int
+ics_heap_snapshot(int fd)
+{
+    ics_snapshot_header header = { ICS_SNAPSHOT_MAGIC, ICS_SNAPSHOT_VERSION, ALIGNMENT, 0, 0 };
+    ics_snapshot_block records[ICS_SNAPSHOT_BATCH];
+    ics_free_header *block = NULL;
+#if ICS_THREAD_SAFE
+    ics_footer *footer = NULL;
+#endif
+    char *heapStart = NULL, *heapEnd = NULL;
+    unsigned int count = 0;
+    int8_t result = 0;
+
+    if(fd < 0) return errno = EINVAL, -1;
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+    return errno = ENOTSUP, -1;
+#endif
+
+    // The heap must not change between counting the blocks and writing them.
+    lockHeap();
+    if(pagesCount)
+    {
+        heapStart = (char*)prologue + PROLOGUE_SIZE;
+        heapEnd = (char*)getHeapBrk() - EPILOGUE_SIZE;
+        header.heap_size = heapEnd - heapStart;
+
+        for(block = (ics_free_header*)heapStart; (char*)block < heapEnd; block = GET_NEXT_HEADER(block, CLEAR_ALLOCATED_FLAG(block->header.block_size)))
+        {
+            ++header.block_count;
+        }
+    }
+
+    result = writeSnapshotBytes(fd, &header, sizeof(header));
+    for(block = (ics_free_header*)heapStart; result != -1 && (char*)block < heapEnd; block = GET_NEXT_HEADER(block, CLEAR_ALLOCATED_FLAG(block->header.block_size)))
+    {
+        records[count].offset = (char*)block - heapStart;
+        records[count].block_size = CLEAR_ALLOCATED_FLAG(block->header.block_size);
+        records[count].requested_size = block->header.requested_size;
+#if ICS_THREAD_SAFE
+        // A queued remote free only cleared requested_size in the header; the footer still has it.
+        footer = GET_CURR_FOOTER(block, records[count].block_size);
+        if(!records[count].requested_size) records[count].requested_size = footer->requested_size;
+#endif
+        records[count].allocated = IS_ALLOCATED(block->header.block_size, records[count].requested_size);
+        records[count].size_class = GET_SIZE_CLASS(records[count].block_size);
+#if ICS_SIZE_CLASSES
+        if(records[count].allocated)
+            records[count].size_class = GET_SIZE_CLASS(findSizeClass(CALC_ACTUAL_BLOCK_SIZE(records[count].requested_size)));
+#endif
+
+        if(++count == ICS_SNAPSHOT_BATCH)
+        {
+            result = writeSnapshotBytes(fd, records, count * sizeof(*records));
+            count = 0;
+        }
+    }
+    if(result != -1 && count) result = writeSnapshotBytes(fd, records, count * sizeof(*records));
+    unlockHeap();
+
+    return result == -1 ? -1 : 0;
+}
+
+int8_t
+writeSnapshotBytes(int fd, const void *buffer, size_t length)
+{
+    const char *current = buffer;
+    ssize_t written = 0;
+
+    while(length)
+    {
+        if( ( written = write(fd, current, length) ) == -1 )
+        {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        current += written;
+        length -= written;
+    }
+
+    return 1;
+}
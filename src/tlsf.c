@@ -0,0 +1,150 @@
+#include "helpers.h"
+#include "debug.h"
+
+
+#if ICS_ENGINE == ICS_ENGINE_TLSF
+/*
+ * Two-level segregated fit index over the free blocks. The first level splits
+ * block sizes by power of two, the second level splits every power of two
+ * range into TLSF_SL_COUNT equal parts. A set bit in flBitmap/slBitmap marks a
+ * non-empty list in tlsfBlocks, so finding, inserting and removing a block is
+ * a constant number of bit scans and pointer updates.
+ */
+static ICS_HEAP_LOCAL uint32_t flBitmap = 0;
+static ICS_HEAP_LOCAL uint32_t slBitmap[TLSF_FL_COUNT];
+static ICS_HEAP_LOCAL ics_free_header *tlsfBlocks[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+
+void
+tlsfMappingInsert(size_t blockSize, unsigned int *fl, unsigned int *sl)
+{
+    unsigned int msb = 0;
+
+    if(blockSize < TLSF_SMALL_BLOCK)
+    {
+        *fl = 0;
+        *sl = blockSize / (TLSF_SMALL_BLOCK / TLSF_SL_COUNT);
+        return;
+    }
+
+    msb = TLSF_FLS(blockSize);
+    *sl = (blockSize >> (msb - TLSF_SL_LOG2)) ^ TLSF_SL_COUNT;
+    *fl = msb - (TLSF_FL_SHIFT - 1);
+}
+
+ics_free_header*
+tlsfFindFit(size_t blockSize)
+{
+    ics_free_header *block = NULL;
+    unsigned int fl = 0, sl = 0;
+    uint32_t slMap = 0, flMap = 0;
+
+    // Round up to the next list boundary so any block in the chosen list fits.
+    if(blockSize >= TLSF_SMALL_BLOCK) blockSize += (1UL << (TLSF_FLS(blockSize) - TLSF_SL_LOG2)) - 1;
+#if BLOCK_GRANULE < TLSF_SMALL_BLOCK / TLSF_SL_COUNT
+    // With a finer granule a small list holds several sizes: take its head if it fits, otherwise move one list up.
+    else if( ( block = tlsfBlocks[0][blockSize / (TLSF_SMALL_BLOCK / TLSF_SL_COUNT)] ) && block->header.block_size >= blockSize )
+    {
+        tlsfRemove(block);
+        return block;
+    }
+    else blockSize = ROUND_UP(blockSize + 1, TLSF_SMALL_BLOCK / TLSF_SL_COUNT);
+#endif
+    tlsfMappingInsert(blockSize, &fl, &sl);
+    if(fl >= TLSF_FL_COUNT) return NULL;
+
+    if( !( slMap = slBitmap[fl] & (~0U << sl) ) )
+    {
+        if( !( flMap = flBitmap & (~0U << (fl + 1)) ) ) return NULL;
+        fl = __builtin_ctz(flMap);
+        slMap = slBitmap[fl];
+    }
+    sl = __builtin_ctz(slMap);
+
+    block = tlsfBlocks[fl][sl];
+    tlsfRemove(block);
+
+    return block;
+}
+
+ics_free_header*
+tlsfFindLargest()
+{
+    ics_free_header *block = NULL, *largest = NULL;
+    unsigned int fl = 0, sl = 0;
+
+    if(!flBitmap) return NULL;
+
+    // The highest non-empty list holds the largest block, but its blocks are not sorted.
+    fl = TLSF_FLS(flBitmap);
+    sl = TLSF_FLS(slBitmap[fl]);
+    for(block = tlsfBlocks[fl][sl]; block; block = NEXT_FREE(block))
+    {
+        if(!largest || block->header.block_size > largest->header.block_size) largest = block;
+    }
+
+    return largest;
+}
+
+void
+tlsfInsert(ics_free_header *block)
+{
+    unsigned int fl = 0, sl = 0;
+
+    tlsfMappingInsert(block->header.block_size, &fl, &sl);
+
+    SET_PREV_FREE(block, NULL);
+    SET_NEXT_FREE(block, tlsfBlocks[fl][sl]);
+    if(NEXT_FREE(block)) SET_PREV_FREE(NEXT_FREE(block), block);
+    tlsfBlocks[fl][sl] = block;
+
+    slBitmap[fl] |= 1U << sl;
+    flBitmap |= 1U << fl;
+}
+
+void
+tlsfRemove(ics_free_header *block)
+{
+    unsigned int fl = 0, sl = 0;
+
+    tlsfMappingInsert(block->header.block_size, &fl, &sl);
+
+    if(PREV_FREE(block)) SET_NEXT_FREE(PREV_FREE(block), NEXT_FREE(block));
+    else tlsfBlocks[fl][sl] = NEXT_FREE(block);
+    if(NEXT_FREE(block)) SET_PREV_FREE(NEXT_FREE(block), PREV_FREE(block));
+    SET_NEXT_FREE(block, NULL);
+    SET_PREV_FREE(block, NULL);
+
+    if(!tlsfBlocks[fl][sl])
+    {
+        slBitmap[fl] &= ~(1U << sl);
+        if(!slBitmap[fl]) flBitmap &= ~(1U << fl);
+    }
+}
+
+#if ICS_THREAD_SAFE
+void
+saveTlsfState(ics_heap_state *state)
+{
+    state->flBitmap = flBitmap;
+    memcpy(state->slBitmap, slBitmap, sizeof(slBitmap));
+    memcpy(state->tlsfBlocks, tlsfBlocks, sizeof(tlsfBlocks));
+}
+
+void
+loadTlsfState(const ics_heap_state *state)
+{
+    flBitmap = state->flBitmap;
+    memcpy(slBitmap, state->slBitmap, sizeof(slBitmap));
+    memcpy(tlsfBlocks, state->tlsfBlocks, sizeof(tlsfBlocks));
+}
+#endif
+
+void
+tlsfClear()
+{
+    flBitmap = 0;
+    memset(slBitmap, 0, sizeof(slBitmap));
+    memset(tlsfBlocks, 0, sizeof(tlsfBlocks));
+}
+#endif
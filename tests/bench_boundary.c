@@ -0,0 +1,143 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Boundary check for the largest request. A request of the largest size
+ * either succeeds with a block that can be filled without touching its
+ * neighbours, or fails with ENOMEM; one byte more always fails with ENOMEM.
+ * The request is made behind a small block first, where whole pages for a
+ * fresh block would no longer fit the header, then again once the heap is
+ * empty. Last, a block is grown in place into a free neighbour that leaves
+ * too little to split off, where the two blocks together are one granule
+ * larger than the header can describe. The heap commits its reservation with
+ * the largest growth factor ics_mem_tune accepts, and larger factors and
+ * reservations that cannot be rounded up must be refused. Prints one line per
+ * check and exits with failure if any of them fails.
+ */
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+#define LARGEST_REQUEST BUDDY_TOP_SIZE
+#else
+#define LARGEST_REQUEST MAX_REQUEST_SIZE
+#endif
+#define SMALL_REQUEST 4064
+// Two blocks of half the block size range each, together one granule above the largest block.
+#define LOWER_BLOCK (32768 - 64)
+#define UPPER_BLOCK (32768 + 64)
+#define PATTERN 0x5a
+
+static int failures = 0;
+
+static void
+check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    if(!ok) ++failures;
+}
+
+static int
+holds_pattern(const unsigned char *buffer, size_t size)
+{
+    size_t i = 0;
+
+    for(i = 0; i < size; ++i)
+    {
+        if(buffer[i] != PATTERN) return 0;
+    }
+
+    return 1;
+}
+
+static void
+check_largest(const char *name, unsigned char *neighbour)
+{
+    char label[64];
+    unsigned char *block = NULL;
+
+    errno = 0;
+    block = ics_malloc(LARGEST_REQUEST);
+    snprintf(label, sizeof(label), "%s: largest request", name);
+    check(label, block ? 1 : errno == ENOMEM);
+    if(!block) return;
+
+    memset(block, 0, LARGEST_REQUEST);
+    snprintf(label, sizeof(label), "%s: neighbour intact", name);
+    check(label, !neighbour || holds_pattern(neighbour, SMALL_REQUEST));
+    snprintf(label, sizeof(label), "%s: free largest", name);
+    check(label, ics_free(block) == 0);
+}
+
+#if ICS_ENGINE != ICS_ENGINE_BUDDY
+static void
+check_grow_into_neighbour()
+{
+    unsigned char *lower = NULL, *upper = NULL, *last = NULL, *grown = NULL;
+
+    // A heap of MAX_PAGES cannot hold them; that must be an ENOMEM.
+    errno = 0;
+    lower = ics_malloc(GET_USABLE_SIZE(LOWER_BLOCK));
+    upper = ics_malloc(GET_USABLE_SIZE(UPPER_BLOCK));
+    last = ics_malloc(100);
+    check("grow: blocks", (lower && upper && last) || errno == ENOMEM);
+    // Only blocks placed next to each other make the case.
+    if(!lower || !upper || !last || upper != lower + LOWER_BLOCK)
+    {
+        if(lower) ics_free(lower);
+        if(upper) ics_free(upper);
+        if(last) ics_free(last);
+        return;
+    }
+
+    memset(lower, PATTERN, GET_USABLE_SIZE(LOWER_BLOCK));
+    check("grow: free neighbour", ics_free(upper) == 0);
+    errno = 0;
+    grown = ics_realloc(lower, LARGEST_REQUEST);
+    check("grow: largest request", grown ? 1 : errno == ENOMEM);
+    check("grow: usable size", ics_usable_size(grown ? grown : lower) >= (grown ? LARGEST_REQUEST : GET_USABLE_SIZE(LOWER_BLOCK)));
+    if(!grown) grown = lower;
+    check("grow: data kept", holds_pattern(grown, GET_USABLE_SIZE(LOWER_BLOCK)));
+    memset(grown, 0, ics_usable_size(grown));
+    check("grow: free grown", ics_free(grown) == 0);
+    check("grow: free last", ics_free(last) == 0);
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    unsigned char *small = NULL, *after = NULL;
+
+    ics_mem_init();
+
+    // Commits grow as fast as allowed, so the last one is cut to what is left of the reservation.
+    errno = 0;
+    check("growth factor above limit refused", ics_mem_tune(ICS_RESERVE_SIZE, MAX_GROWTH_FACTOR + 1) == -1 && errno == EINVAL);
+    errno = 0;
+    check("unroundable reservation refused", ics_mem_tune(SIZE_MAX, 1) == -1 && errno == EINVAL);
+    check("largest growth factor", ics_mem_tune(ICS_RESERVE_SIZE, MAX_GROWTH_FACTOR) == 0 || !ICS_REGION_RESERVE);
+
+    // A small block first, so whole pages for the largest request no longer fit one block.
+    if( ( small = ics_malloc(SMALL_REQUEST) ) ) memset(small, PATTERN, SMALL_REQUEST);
+    check("small block", small != NULL);
+    check_largest("behind small block", small);
+
+    after = ics_malloc(100);
+    check("allocate after", after != NULL);
+    check("free small block", small && ics_free(small) == 0);
+    check("free after", after && ics_free(after) == 0);
+
+    check_largest("emptied heap", NULL);
+
+#if ICS_ENGINE != ICS_ENGINE_BUDDY
+    check_grow_into_neighbour();
+#endif
+
+    errno = 0;
+    check("one byte more fails", !ics_malloc(LARGEST_REQUEST + 1) && errno == ENOMEM);
+
+    ics_mem_fini();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
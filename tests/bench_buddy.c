@@ -0,0 +1,98 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Throughput and fragmentation benchmark for power-of-two heavy workloads.
+ * Most requests are exact powers of two, the rest are just above or below one.
+ * Reports operations per second, failed allocations and the internal
+ * fragmentation of the live blocks (bytes the allocator holds for them that the
+ * caller did not ask for, block headers included). Compare
+ * bin/bench_buddy-default.bin, bin/bench_buddy-tlsf.bin and
+ * bin/bench_buddy-buddy.bin.
+ */
+
+#define SLOTS 64
+#define OPS 400000
+#define MIN_ORDER 4
+#define MAX_ORDER 11
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+#define BLOCK_OVERHEAD 0
+#define ENGINE_NAME "buddy"
+#elif ICS_ENGINE == ICS_ENGINE_TLSF
+#define BLOCK_OVERHEAD (HEADER_SIZE + FOOTER_SIZE)
+#define ENGINE_NAME "tlsf"
+#else
+#define BLOCK_OVERHEAD (HEADER_SIZE + FOOTER_SIZE)
+#define ENGINE_NAME "next-fit"
+#endif
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t
+request_size()
+{
+    size_t size = 1UL << (MIN_ORDER + rand() % (MAX_ORDER - MIN_ORDER + 1));
+
+    switch(rand() % 8)
+    {
+        case 0: return size - size / 4;
+        case 1: return size + size / 4;
+        default: return size;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    void *slots[SLOTS] = { 0 };
+    size_t sizes[SLOTS] = { 0 };
+    size_t failures = 0, requested = 0, footprint = 0;
+    uint64_t start = 0, elapsed = 0;
+    int i = 0, op = 0;
+
+    ics_mem_init();
+    srand(argc > 1 ? atoi(argv[1]) : 53);
+
+    start = now_ns();
+    for(op = 0; op < OPS; ++op)
+    {
+        i = rand() % SLOTS;
+        if(slots[i])
+        {
+            ics_free(slots[i]);
+            slots[i] = NULL;
+            continue;
+        }
+
+        sizes[i] = request_size();
+        if( !( slots[i] = ics_malloc(sizes[i]) ) ) ++failures;
+    }
+    elapsed = now_ns() - start;
+
+    for(i = 0; i < SLOTS; ++i)
+    {
+        if(!slots[i]) continue;
+        requested += sizes[i];
+        footprint += ics_usable_size(slots[i]) + BLOCK_OVERHEAD;
+    }
+
+    printf("engine: %s\n", ENGINE_NAME);
+    printf("ops/sec=%.0f failed=%zu live=%zu bytes footprint=%zu bytes internal fragmentation=%.1f%%\n",
+           OPS * 1e9 / elapsed, failures, requested, footprint,
+           footprint ? 100.0 * (footprint - requested) / footprint : 0.0);
+
+    for(i = 0; i < SLOTS; ++i) ics_free(slots[i]);
+    ics_mem_fini();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#include "icsmm.h"
+#include "debug.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * False sharing benchmark. Small objects are allocated back to back, as a
+ * producer would before handing them to workers, and every worker thread then
+ * updates its own object in a tight loop. Objects whose bytes share a cache
+ * line make the line bounce between cores even though no data is shared.
+ * Reports how many objects share a line with another object and the time per
+ * update. Compare bin/bench_false_sharing-thread-safe.bin with
+ * bin/bench_false_sharing-cacheline.bin (ICS_CACHELINE_PAD).
+ */
+
+#define THREADS 4
+#define OBJECT_SIZE 24
+#define UPDATES 20000000
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void*
+worker(void *object)
+{
+    volatile uint64_t *counter = object;
+
+    for(long i = 0; i < UPDATES; ++i) ++*counter;
+
+    return NULL;
+}
+
+static int
+shares_line(char *a, char *b)
+{
+    uintptr_t aFirst = (uintptr_t)a / ICS_CACHE_LINE, aLast = ((uintptr_t)a + OBJECT_SIZE - 1) / ICS_CACHE_LINE;
+    uintptr_t bFirst = (uintptr_t)b / ICS_CACHE_LINE, bLast = ((uintptr_t)b + OBJECT_SIZE - 1) / ICS_CACHE_LINE;
+
+    return aFirst <= bLast && bFirst <= aLast;
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t threads[THREADS];
+    char *objects[THREADS] = { 0 };
+    uint64_t start = 0, elapsed = 0;
+    int i = 0, j = 0, shared = 0;
+
+    ics_mem_init();
+
+    for(i = 0; i < THREADS; ++i)
+    {
+        if( !( objects[i] = ics_malloc(OBJECT_SIZE) ) ) return EXIT_FAILURE;
+        memset(objects[i], 0, OBJECT_SIZE);
+    }
+
+    for(i = 0; i < THREADS; ++i)
+    {
+        for(j = 0; j < THREADS; ++j)
+        {
+            if(i != j && shares_line(objects[i], objects[j]))
+            {
+                ++shared;
+                break;
+            }
+        }
+    }
+
+    start = now_ns();
+    for(i = 0; i < THREADS; ++i) pthread_create(&threads[i], NULL, worker, objects[i]);
+    for(i = 0; i < THREADS; ++i) pthread_join(threads[i], NULL);
+    elapsed = now_ns() - start;
+
+    printf("cache line padding: %s\n", ICS_CACHELINE_PAD ? "on" : "off");
+    printf("threads=%d objects sharing a line=%d time per update=%.2f ns\n",
+           THREADS, shared, (double)elapsed / UPDATES);
+
+    for(i = 0; i < THREADS; ++i) ics_free(objects[i]);
+    ics_mem_fini();
+    return EXIT_SUCCESS;
+}
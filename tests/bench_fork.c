@@ -0,0 +1,182 @@
+#include "icsmm.h"
+#include "debug.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Fork under load, as a pre-fork server does. Worker threads keep allocating,
+ * filling, checking and freeing blocks, handing every other one to another
+ * worker through a shared slot so frees cross heaps too. Meanwhile the main
+ * thread forks; every child allocates and frees a batch of blocks from its
+ * main thread and from a new thread, checks their contents, frees the blocks
+ * the workers left behind and exits. A child that hangs or finds a corrupt
+ * block counts as failed. Reports the time fork() takes with the allocator's
+ * fork handlers. Without ICS_THREAD_SAFE there are no workers and only the
+ * main thread's own allocations are live across the fork.
+ */
+
+#if ICS_THREAD_SAFE
+#define THREADS 4
+#else
+#define THREADS 0
+#endif
+#define SLOTS 32
+#define FORKS 200
+#define CHILD_OPS 20000
+#define CHILD_TIMEOUT 5
+
+static void *exchange[SLOTS];
+static volatile int running = 1;
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t
+fill(unsigned char *block, unsigned int seed)
+{
+    size_t size = 16 + seed % 400;
+
+    memset(block, seed & 0xff, size);
+    block[0] = size & 0xff;
+    block[1] = size >> 8;
+
+    return size;
+}
+
+static int
+check(unsigned char *block)
+{
+    size_t size = block[0] | (size_t)block[1] << 8;
+
+    for(size_t i = 2; i < size; ++i)
+    {
+        if(block[i] != block[2]) return -1;
+    }
+
+    return 0;
+}
+
+static void*
+worker(void *arg)
+{
+    unsigned int seed = (uintptr_t)arg;
+    unsigned char *block = NULL, *other = NULL;
+
+    while(running)
+    {
+        seed = seed * 1103515245 + 12345;
+        if( !( block = ics_malloc(16 + seed % 400) ) ) continue;
+        fill(block, seed);
+
+        // Every other block is freed by whichever worker takes it out of the slot.
+        if(seed & 0x100)
+        {
+            other = __atomic_exchange_n(&exchange[seed % SLOTS], block, __ATOMIC_ACQ_REL);
+            if(!other) continue;
+            block = other;
+        }
+        if(check(block) == -1) abort();
+        ics_free(block);
+    }
+
+    return NULL;
+}
+
+static void*
+child_allocate(void *arg)
+{
+    unsigned char *blocks[SLOTS] = { 0 };
+    unsigned int seed = getpid() + (uintptr_t)arg;
+    int i = 0, op = 0;
+
+    for(op = 0; op < CHILD_OPS; ++op)
+    {
+        seed = seed * 1103515245 + 12345;
+        i = seed % SLOTS;
+        if(blocks[i])
+        {
+            if(check(blocks[i]) == -1) return (void*)-1;
+            ics_free(blocks[i]);
+            blocks[i] = NULL;
+            continue;
+        }
+        if( !( blocks[i] = ics_malloc(16 + seed % 400) ) ) return (void*)-1;
+        fill(blocks[i], seed);
+    }
+
+    for(i = 0; i < SLOTS; ++i)
+    {
+        if(blocks[i]) ics_free(blocks[i]);
+    }
+
+    return NULL;
+}
+
+static int
+child()
+{
+    pthread_t thread;
+    void *result = NULL;
+    int i = 0;
+
+    // A new thread in the child registers a heap of its own while the main thread keeps allocating.
+    if(THREADS && pthread_create(&thread, NULL, child_allocate, (void*)1) != 0) return EXIT_FAILURE;
+    if(child_allocate(NULL)) return EXIT_FAILURE;
+    if(THREADS && (pthread_join(thread, &result) != 0 || result)) return EXIT_FAILURE;
+
+    // Blocks the workers left in the slots belong to heaps whose threads do not exist here.
+    for(i = 0; i < SLOTS; ++i)
+    {
+        if(exchange[i] && check(exchange[i]) == -1) return EXIT_FAILURE;
+        if(exchange[i]) ics_free(exchange[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t threads[THREADS + 1];
+    void *live = NULL;
+    uint64_t start = 0, forkTime = 0;
+    int i = 0, status = 0, failed = 0;
+    pid_t pid = 0;
+
+    ics_mem_init();
+    if( !( live = ics_malloc(64) ) ) return EXIT_FAILURE;
+
+    for(i = 0; i < THREADS; ++i) pthread_create(&threads[i], NULL, worker, (void*)(uintptr_t)(i + 1));
+
+    for(i = 0; i < FORKS; ++i)
+    {
+        start = now_ns();
+        if( ( pid = fork() ) == -1 ) return EXIT_FAILURE;
+        if(pid == 0)
+        {
+            alarm(CHILD_TIMEOUT);
+            _exit(child());
+        }
+        forkTime += now_ns() - start;
+
+        if(waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) ++failed;
+    }
+
+    running = 0;
+    for(i = 0; i < THREADS; ++i) pthread_join(threads[i], NULL);
+
+    printf("threads=%d forks=%d failed=%d fork=%.1f us\n", THREADS, FORKS, failed, forkTime / 1e3 / FORKS);
+
+    ics_free(live);
+    ics_mem_fini();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
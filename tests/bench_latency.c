@@ -0,0 +1,96 @@
+#include "icsmm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Latency benchmark for ics_malloc/ics_free. Runs a random mix of small
+ * allocations and frees that keeps the heap fragmented and reports the latency
+ * distribution of both calls. `make bench` builds it against every variant,
+ * e.g. compare bin/bench_latency-default.bin with bin/bench_latency-tlsf.bin
+ * for the worst case of the next-fit and TLSF engines.
+ */
+
+#define SLOTS 256
+#define OPS 400000
+#define MAX_SMALL_REQUEST 240
+#define MAX_LARGE_REQUEST 1200
+
+typedef struct {
+    uint32_t *samples;
+    size_t count;
+} latency;
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+compare_samples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void
+report(const char *name, latency *l)
+{
+    uint64_t sum = 0;
+
+    if(!l->count) return;
+    qsort(l->samples, l->count, sizeof(*l->samples), compare_samples);
+    for(size_t i = 0; i < l->count; ++i) sum += l->samples[i];
+
+    printf("%-10s n=%-8zu mean=%-6lu p50=%-6u p99=%-6u p99.9=%-6u max=%u (ns)\n",
+           name, l->count, sum / l->count,
+           l->samples[l->count / 2],
+           l->samples[l->count * 99 / 100],
+           l->samples[l->count * 999 / 1000],
+           l->samples[l->count - 1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+    latency mallocs = { calloc(OPS, sizeof(uint32_t)), 0 };
+    latency frees = { calloc(OPS, sizeof(uint32_t)), 0 };
+    void *slots[SLOTS] = { 0 };
+    uint64_t start = 0;
+    size_t size = 0;
+    int i = 0, op = 0;
+
+    ics_mem_init();
+    srand(argc > 1 ? atoi(argv[1]) : 53);
+
+    for(op = 0; op < OPS; ++op)
+    {
+        i = rand() % SLOTS;
+        if(slots[i])
+        {
+            start = now_ns();
+            ics_free(slots[i]);
+            frees.samples[frees.count++] = now_ns() - start;
+            slots[i] = NULL;
+            continue;
+        }
+
+        size = 1 + rand() % (rand() % 8 ? MAX_SMALL_REQUEST : MAX_LARGE_REQUEST);
+        start = now_ns();
+        slots[i] = ics_malloc(size);
+        mallocs.samples[mallocs.count++] = now_ns() - start;
+    }
+
+    printf("engine: %s\n", ICS_ENGINE == ICS_ENGINE_TLSF ? "tlsf" : ICS_ENGINE == ICS_ENGINE_BUDDY ? "buddy" : "next-fit");
+    report("ics_malloc", &mallocs);
+    report("ics_free", &frees);
+
+    ics_mem_fini();
+    free(mallocs.samples);
+    free(frees.samples);
+    return EXIT_SUCCESS;
+}
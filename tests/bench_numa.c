@@ -0,0 +1,109 @@
+#include "icsmm.h"
+#include "debug.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * NUMA locality check. Every worker thread allocates objects from its own
+ * heap, then the main thread frees all of them, so every free is remote.
+ * Reports the time per ics_malloc and the counters of ics_get_numa_stats. On
+ * a single node machine no block can cross nodes, so both remote-node counters
+ * must stay 0. Builds without ICS_NUMA must refuse the stats with EINVAL.
+ * Prints one line per check and exits with failure if any of them fails.
+ */
+
+#define THREADS 4
+#define OBJECTS 20000
+#define OBJECT_SIZE 48
+
+static void *objects[THREADS][OBJECTS];
+static uint64_t allocTime[THREADS];
+static int failures = 0;
+#if ICS_NUMA
+// Keeps every worker alive until all have allocated, so none adopts the heap of another.
+static pthread_barrier_t allocationsDone;
+#endif
+
+static void
+check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    if(!ok) ++failures;
+}
+
+#if ICS_NUMA
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void*
+worker(void *arg)
+{
+    long id = (long)arg;
+    uint64_t start = now_ns();
+    int i = 0;
+
+    for(i = 0; i < OBJECTS; ++i) objects[id][i] = ics_malloc(OBJECT_SIZE);
+    allocTime[id] = now_ns() - start;
+    pthread_barrier_wait(&allocationsDone);
+
+    return NULL;
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    ics_numa_stats stats;
+    uint64_t elapsed = 0;
+    int allocated = 1, freed = 1;
+    long i = 0, j = 0;
+#if ICS_NUMA
+    pthread_t threads[THREADS];
+#endif
+
+    ics_mem_init();
+
+#if ICS_NUMA
+    pthread_barrier_init(&allocationsDone, NULL, THREADS);
+    for(i = 0; i < THREADS; ++i) pthread_create(&threads[i], NULL, worker, (void*)i);
+    for(i = 0; i < THREADS; ++i) pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&allocationsDone);
+
+    for(i = 0; i < THREADS; ++i)
+    {
+        elapsed += allocTime[i];
+        for(j = 0; j < OBJECTS; ++j)
+        {
+            if(!objects[i][j]) allocated = 0;
+            else if(ics_free(objects[i][j]) != 0) freed = 0;
+        }
+    }
+    printf("malloc=%.1f ns\n", (double)elapsed / (THREADS * OBJECTS));
+
+    check("all allocations succeeded", allocated);
+    check("all remote frees succeeded", freed);
+    check("stats", ics_get_numa_stats(&stats) == 0);
+    printf("nodes=%u heaps=%u remote_frees=%zu remote_node_frees=%zu remote_node_allocs=%zu\n",
+           stats.nodes, stats.heaps, stats.remote_frees, stats.remote_node_frees, stats.remote_node_allocs);
+    check("one heap per worker", stats.heaps >= THREADS);
+    check("every free was remote", stats.remote_frees == THREADS * OBJECTS);
+    if(stats.nodes == 1)
+    {
+        check("no remote-node frees on one node", stats.remote_node_frees == 0);
+        check("no remote-node allocations on one node", stats.remote_node_allocs == 0);
+    }
+#else
+    errno = 0;
+    check("stats refused without ICS_NUMA", ics_get_numa_stats(&stats) == -1 && errno == EINVAL);
+#endif
+
+    ics_mem_fini();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,148 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Warm restart benchmark for ICS_PERSISTENT. Builds an index of many small
+ * objects in a heap file, detaches, and attaches again: first wherever the
+ * system maps it, then at another base. Every attach must find the whole
+ * index through ics_get_root(), and allocation must continue after it. The
+ * objects link to each other by offsets from the root, so the index survives
+ * the move. Finally a block header is overwritten in the file and the attach
+ * must refuse the heap. Reports the time to build the index against the time
+ * to attach to it.
+ */
+
+#define OBJECTS 400000
+#define RELOCATED_BASE ((void*)0x600000000000UL)
+
+typedef struct node {
+    uint64_t key;
+    int64_t next;
+} node;
+
+typedef struct index_root {
+    uint64_t count;
+    int64_t first;
+} index_root;
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+check_index(index_root *root)
+{
+    uint64_t count = 0;
+    int64_t offset = root->first;
+
+    for(; offset; offset = ((node*)((char*)root + offset))->next, ++count)
+    {
+        if(((node*)((char*)root + offset))->key != count) return -1;
+    }
+
+    return count == root->count ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char path[] = "/tmp/bench_persist.XXXXXX";
+    index_root *root = NULL;
+    node *current = NULL, *last = NULL;
+    uint64_t start = 0, build = 0, attach = 0, i = 0;
+    int fd = -1, result = 0, corrupt = 0, truncated = 0;
+    void *firstRoot = NULL;
+
+    ics_mem_init();
+    if( ( fd = mkstemp(path) ) == -1 ) return EXIT_FAILURE;
+    close(fd);
+
+    if(ics_mem_attach(path, NULL) == -1)
+    {
+        printf("heap files need ICS_PERSISTENT\n");
+        unlink(path);
+        return EXIT_SUCCESS;
+    }
+
+    start = now_ns();
+    if( !( root = ics_malloc(sizeof(*root)) ) ) return EXIT_FAILURE;
+    root->count = 0;
+    root->first = 0;
+    for(i = 0; i < OBJECTS; ++i)
+    {
+        if( !( current = ics_malloc(sizeof(*current)) ) ) return EXIT_FAILURE;
+        current->key = i;
+        current->next = 0;
+        if(last) last->next = (char*)current - (char*)root;
+        else root->first = (char*)current - (char*)root;
+        last = current;
+        ++root->count;
+    }
+    build = now_ns() - start;
+    ics_set_root(root);
+    firstRoot = root;
+    if(ics_mem_detach() == -1) return EXIT_FAILURE;
+
+    start = now_ns();
+    result = ics_mem_attach(path, NULL);
+    attach = now_ns() - start;
+    if(result != 1 || !( root = ics_get_root() ) || check_index(root) == -1)
+    {
+        printf("reattach failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // Keep allocating: every third object is replaced by a copy in a new block.
+    for(current = (node*)((char*)root + root->first), last = NULL; current; current = current->next ? (node*)((char*)root + current->next) : NULL)
+    {
+        if(current->key % 3 == 0 && last)
+        {
+            node *replacement = ics_malloc(sizeof(*replacement));
+            if(!replacement) return EXIT_FAILURE;
+            *replacement = *current;
+            last->next = (char*)replacement - (char*)root;
+            ics_free(current);
+            current = replacement;
+        }
+        last = current;
+    }
+    if(check_index(root) == -1 || ics_mem_detach() == -1) return EXIT_FAILURE;
+
+    if( ( result = ics_mem_attach(path, RELOCATED_BASE) ) == -1 && errno == EEXIST ) result = ics_mem_attach(path, NULL);
+    if(result != 1 || !( root = ics_get_root() ) || check_index(root) == -1)
+    {
+        printf("relocated attach failed\n");
+        return EXIT_FAILURE;
+    }
+    printf("objects=%d build=%.1f ms attach=%.1f ms relocated=%s\n",
+           OBJECTS, build / 1e6, attach / 1e6, (void*)root != firstRoot ? "yes" : "no");
+
+    // A block header overwritten behind the allocator's back must stop the next attach.
+    ics_mem_detach();
+    if( ( fd = open(path, O_RDWR) ) == -1 ) return EXIT_FAILURE;
+    if(pwrite(fd, "\xff\xff", 2, PAGE_SIZE + HEAP_START_PAD + PROLOGUE_SIZE) != 2) return EXIT_FAILURE;
+    close(fd);
+    result = ics_mem_attach(path, NULL);
+    corrupt = result == -1 && errno == EIO;
+    printf("corrupt heap: attach=%d errno=%s\n", result, corrupt ? "EIO" : "unexpected");
+
+    // So must a file cut short inside its header page.
+    if(truncate(path, PAGE_SIZE / 2) == -1) return EXIT_FAILURE;
+    result = ics_mem_attach(path, NULL);
+    truncated = result == -1 && errno == EIO;
+    printf("truncated file: attach=%d errno=%s\n", result, truncated ? "EIO" : "unexpected");
+
+    unlink(path);
+    ics_mem_fini();
+    return corrupt && truncated ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Check of the heap limits and the pressure handler. The heap gets a soft
+ * limit of two growth units and a hard limit of four, then objects are
+ * allocated and kept well past the hard limit. First the handler frees the
+ * older half of the objects on ICS_PRESSURE_HARD, so every allocation must
+ * succeed after a retry; then it refuses, so the next allocation must fail
+ * with ENOMEM. ICS_PRESSURE_SOFT must be reported exactly once, and
+ * allocations made by the handler itself must fail without calling it again.
+ * Prints one line per check and exits with failure if any of them fails.
+ */
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+#define UNIT BUDDY_TOP_SIZE
+#else
+#define UNIT PAGE_SIZE
+#endif
+#define SOFT_UNITS 2
+#define HARD_UNITS 4
+#define OBJECT_SIZE 200
+#define OBJECTS (3 * HARD_UNITS * UNIT / OBJECT_SIZE)
+
+// Room for the objects kept once the handler stops releasing.
+static void *objects[2 * OBJECTS];
+static unsigned int oldest = 0, count = 0;
+static unsigned int softCalls = 0, hardCalls = 0, depth = 0, maxDepth = 0, nestedSuccesses = 0;
+static size_t largestHeap = 0;
+static int release = 1, failures = 0;
+
+static void
+check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    if(!ok) ++failures;
+}
+
+static int
+handler(int level, size_t heap_bytes, size_t request, void *arg)
+{
+    void *nested = NULL;
+    unsigned int target = 0;
+
+    if(++depth > maxDepth) maxDepth = depth;
+    if(heap_bytes > largestHeap) largestHeap = heap_bytes;
+
+    if(level == ICS_PRESSURE_SOFT)
+    {
+        ++softCalls;
+        --depth;
+        return 0;
+    }
+
+    ++hardCalls;
+
+    // The heap is at its hard limit: this must fail without a nested call.
+    if( ( nested = ics_malloc(UNIT) ) )
+    {
+        ++nestedSuccesses;
+        ics_free(nested);
+    }
+
+    if(release)
+    {
+        for(target = oldest + (count - oldest) / 2; oldest < target; ++oldest)
+        {
+            ics_free(objects[oldest]);
+            objects[oldest] = NULL;
+        }
+    }
+
+    --depth;
+    return release;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int hardBefore = 0;
+    void *last = NULL;
+    int allSucceeded = 1;
+
+    ics_mem_init();
+    check("set limits", ics_set_heap_limits(SOFT_UNITS * UNIT, HARD_UNITS * UNIT) == 0);
+    check("soft above hard refused", ics_set_heap_limits(2 * UNIT, UNIT) == -1 && errno == EINVAL);
+    ics_set_heap_limits(SOFT_UNITS * UNIT, HARD_UNITS * UNIT);
+    ics_set_pressure_handler(handler, NULL);
+
+    for(count = 0; count < OBJECTS; ++count)
+    {
+        if( !( objects[count] = ics_malloc(OBJECT_SIZE) ) ) allSucceeded = 0;
+    }
+
+    check("allocations retried after release", allSucceeded);
+    check("hard pressure reported", hardCalls > 0);
+    check("soft pressure reported once", softCalls == 1);
+    check("heap within hard limit", largestHeap <= HARD_UNITS * UNIT);
+    check("handler not reentered", maxDepth == 1);
+    check("nested allocation failed", nestedSuccesses == 0);
+
+    release = 0;
+    hardBefore = hardCalls;
+    errno = 0;
+    while( count < 2 * OBJECTS && ( last = ics_malloc(OBJECT_SIZE) ) ) objects[count++] = last;
+    check("refusing handler gives ENOMEM", !last && errno == ENOMEM);
+    check("hard pressure reported once more", hardCalls == hardBefore + 1);
+    check("soft pressure still once", softCalls == 1);
+
+    for(; oldest < count; ++oldest) ics_free(objects[oldest]);
+    ics_set_pressure_handler(NULL, NULL);
+    ics_set_heap_limits(0, 0);
+    ics_mem_fini();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
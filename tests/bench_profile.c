@@ -0,0 +1,204 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Check of the sampling profiler. Objects of mixed sizes are allocated and
+ * freed at once with a sampling interval of INTERVAL bytes; the samples taken,
+ * each standing for INTERVAL bytes, must add up to the bytes allocated within
+ * TOLERANCE, and no sample may outlive its object. Then LIVE samples in one
+ * long probe chain are removed in scrambled order: each must leave the sample
+ * table while all others can still be found, so the backward-shift deletion
+ * keeps the chain intact. Both dump formats are parsed back and must list exactly the
+ * live samples. Last, intervals too large to draw a distance from are cut
+ * instead of faulting. Builds without ICS_PROFILE must dump no samples.
+ * Prints one line per check and exits with failure if any of them fails.
+ */
+
+#define INTERVAL 4096
+#define OPS 200000
+#define TOLERANCE 0.1
+#define LIVE 128
+#define LIVE_SIZE 32
+#define DUMPED 16
+
+static int failures = 0;
+
+static void
+check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    if(!ok) ++failures;
+}
+
+#if ICS_PROFILE
+static void
+check_sampled_total()
+{
+    size_t allocated = 0, sampled = 0, size = 0;
+    unsigned int before = 0;
+    void *ptr = NULL;
+    int op = 0, ok = 1;
+
+    srand(53);
+    ics_profile_set_interval(INTERVAL);
+    for(op = 0; op < OPS; ++op)
+    {
+        size = 16 + rand() % 240;
+        before = profileLive;
+        if( !( ptr = ics_malloc(size) ) )
+        {
+            ok = 0;
+            continue;
+        }
+        allocated += size;
+        if(profileLive > before) ++sampled;
+        if(ics_free(ptr) != 0) ok = 0;
+    }
+    ics_profile_set_interval(0);
+
+    printf("allocated=%zu bytes sampled=%zu estimate=%zu bytes\n", allocated, sampled, sampled * INTERVAL);
+    check("sampling: allocations and frees", ok);
+    check("sampling: estimate within tolerance",
+          sampled * INTERVAL > allocated * (1 - TOLERANCE) && sampled * INTERVAL < allocated * (1 + TOLERANCE));
+    check("sampling: freed samples dropped", profileLive == 0);
+}
+
+static void
+check_backward_shift()
+{
+    void *samples[LIVE];
+    size_t homes[] = { ICS_PROFILE_SLOTS - 2, ICS_PROFILE_SLOTS - 1, 0, 3 };
+    uintptr_t address = 0;
+    int i = 0, j = 0, k = 0, count = 0, ok = 1;
+
+    /*
+     * The table is filled directly with addresses that hash to a few
+     * neighbouring home slots, LIVE / 4 each, so they form one probe chain
+     * that wraps around the end of the table. They are never dereferenced.
+     */
+    for(i = 0; i < 4; ++i)
+    {
+        for(count = 0, address = ALIGNMENT; count < LIVE / 4; address += ALIGNMENT)
+        {
+            if(PROFILE_HASH(address) == homes[i]) samples[i * (LIVE / 4) + count++] = (void*)address;
+        }
+    }
+
+    ics_profile_set_interval(1);
+    for(i = 0; i < LIVE; ++i) profileSample(samples[i], LIVE_SIZE);
+    ics_profile_set_interval(0);
+    check("delete: every sample recorded", profileLive == LIVE);
+
+    // 37 is coprime to LIVE, so this removes every sample once, far from insertion order.
+    for(i = 0; i < LIVE; ++i)
+    {
+        j = (i * 37) % LIVE;
+        profileRemove(samples[j]);
+        if(findProfileSlot(samples[j], 0)) ok = 0;
+        samples[j] = NULL;
+
+        for(k = 0; k < LIVE; ++k)
+        {
+            if(samples[k] && !findProfileSlot(samples[k], 0)) ok = 0;
+        }
+    }
+
+    check("delete: remaining samples found", ok);
+    check("delete: table empty", profileLive == 0);
+}
+#endif
+
+static void
+check_dump()
+{
+    void *objects[DUMPED];
+    char line[4096];
+    size_t expected = 0, bytes = 0, size = 0, listed = 0, sum = 0, interval = 0;
+    unsigned int count = 0, samples = ICS_PROFILE ? DUMPED : 0;
+    int i = 0, header = 0, libraries = 0, ok = 1;
+    FILE *file = NULL;
+    char *last = NULL;
+
+    ics_profile_set_interval(1);
+    for(i = 0; i < DUMPED; ++i)
+    {
+        if( !( objects[i] = ics_malloc(LIVE_SIZE + i) ) ) ok = 0;
+        expected += ICS_PROFILE ? LIVE_SIZE + i : 0;
+    }
+
+    // pprof heap_v2: a header with the totals, one line per sample, then the mappings.
+    if( ( file = tmpfile() ) && ics_profile_dump(fileno(file), ICS_PROFILE_PPROF) == 0 )
+    {
+        rewind(file);
+        while(fgets(line, sizeof(line), file))
+        {
+            if(sscanf(line, "heap profile: %u: %zu [%*u: %*u] @ heap_v2/%zu", &count, &bytes, &interval) == 3) ++header;
+            else if(sscanf(line, "1: %zu [1: %*u] @ 0x", &size) == 1)
+            {
+                ++listed;
+                sum += size;
+            }
+            else if(strcmp(line, "MAPPED_LIBRARIES:\n") == 0) ++libraries;
+        }
+    }
+    else ok = 0;
+    if(file) fclose(file);
+    check("pprof: header", header == 1 && count == samples && bytes == expected && interval == 1);
+    check("pprof: one line per sample", listed == samples && sum == expected);
+    check("pprof: mapped libraries", libraries == 1);
+
+    // Collapsed stacks: "root;...;leaf bytes" per sample.
+    listed = sum = 0;
+    if( ( file = tmpfile() ) && ics_profile_dump(fileno(file), ICS_PROFILE_COLLAPSED) == 0 )
+    {
+        rewind(file);
+        while(fgets(line, sizeof(line), file))
+        {
+            if( !( last = strrchr(line, ' ') ) || sscanf(last, " %zu", &size) != 1 ) continue;
+            ++listed;
+            sum += size;
+        }
+    }
+    else ok = 0;
+    if(file) fclose(file);
+    check("collapsed: one line per sample", listed == samples && sum == expected);
+
+    errno = 0;
+    check("unknown format refused", ics_profile_dump(1, -1) == -1 && errno == EINVAL);
+
+    ics_profile_set_interval(0);
+    for(i = 0; i < DUMPED; ++i)
+    {
+        if(objects[i] && ics_free(objects[i]) != 0) ok = 0;
+    }
+    check("dump: allocations and frees", ok);
+}
+
+int
+main(int argc, char *argv[])
+{
+    void *ptr = NULL;
+
+    ics_mem_init();
+
+#if ICS_PROFILE
+    check_sampled_total();
+    check_backward_shift();
+#endif
+    check_dump();
+
+    // Twice these intervals does not fit the distance drawn; they must be cut, not divide by zero.
+    ics_profile_set_interval((size_t)1 << 63);
+    ics_profile_set_interval(SIZE_MAX);
+    ptr = ics_malloc(LIVE_SIZE);
+    check("largest interval", ptr && profileLive == 0);
+    ics_profile_set_interval(0);
+    ics_free(ptr);
+
+    ics_mem_fini();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
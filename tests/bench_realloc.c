@@ -0,0 +1,116 @@
+#include "icsmm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Append benchmark for ics_realloc. A few buffers grow in small steps, the way
+ * string builders and vectors do, while short-lived objects are allocated and
+ * freed around them. Every round is run once with buffers from ics_malloc and
+ * once with buffers from ics_malloc_flags(size, ICS_GROWABLE), and reports how
+ * many of the ics_realloc calls had to move and copy the buffer. Each run gets
+ * a fresh heap in its own process. The flag must copy fewer bytes than plain
+ * ics_malloc; the buddy engine ignores it, so there both must copy the same.
+ * Exits with failure otherwise.
+ */
+
+#define BUFFERS 2
+#define ROUNDS 200
+#define APPEND 24
+#define MAX_BUFFER 4000
+#define OBJECTS 16
+#define MAX_OBJECT 48
+
+static int failures = 0;
+
+static void
+check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    if(!ok) ++failures;
+}
+
+// Returns the bytes copied by the run, or (size_t)-1 if the child failed.
+static size_t
+run(const char *name, unsigned int flags, unsigned int seed)
+{
+    char *buffers[BUFFERS] = { 0 };
+    void *objects[OBJECTS] = { 0 };
+    size_t sizes[BUFFERS] = { 0 }, reallocs = 0, moves = 0, copied = (size_t)-1;
+    char *grown = NULL;
+    int round = 0, b = 0, i = 0, channel[2];
+
+    if(pipe(channel) == -1) return copied;
+    if(fork()) 
+    {
+        close(channel[1]);
+        if(read(channel[0], &copied, sizeof(copied)) != sizeof(copied)) copied = (size_t)-1;
+        close(channel[0]);
+        wait(NULL);
+        return copied;
+    }
+    close(channel[0]);
+    copied = 0;
+
+    ics_mem_init();
+    srand(seed);
+
+    for(round = 0; round < ROUNDS; ++round)
+    {
+        for(b = 0; b < BUFFERS; ++b)
+        {
+            if(!buffers[b])
+            {
+                sizes[b] = APPEND;
+                buffers[b] = ics_malloc_flags(sizes[b], flags);
+                continue;
+            }
+
+            if( !( grown = ics_realloc(buffers[b], sizes[b] + APPEND) ) ) continue;
+            ++reallocs;
+            if(grown != buffers[b])
+            {
+                ++moves;
+                copied += sizes[b];
+            }
+            buffers[b] = grown;
+            sizes[b] += APPEND;
+
+            if(sizes[b] + APPEND > MAX_BUFFER)
+            {
+                ics_free(buffers[b]);
+                buffers[b] = NULL;
+            }
+        }
+
+        i = rand() % OBJECTS;
+        if(objects[i]) ics_free(objects[i]);
+        objects[i] = ics_malloc(1 + rand() % MAX_OBJECT);
+    }
+
+    printf("%-16s reallocs=%-6zu moved=%-6zu copied=%zu bytes\n", name, reallocs, moves, copied);
+    fflush(stdout);
+    if(write(channel[1], &copied, sizeof(copied)) != sizeof(copied)) exit(EXIT_FAILURE);
+    ics_mem_fini();
+    exit(EXIT_SUCCESS);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int seed = argc > 1 ? atoi(argv[1]) : 53;
+    size_t plain = 0, growable = 0;
+
+    printf("engine: %s\n", ICS_ENGINE == ICS_ENGINE_TLSF ? "tlsf" : ICS_ENGINE == ICS_ENGINE_BUDDY ? "buddy" : "next-fit");
+    fflush(stdout);
+    plain = run("ics_malloc", 0, seed);
+    growable = run("ICS_GROWABLE", ICS_GROWABLE, seed);
+
+    check("both runs completed", plain != (size_t)-1 && growable != (size_t)-1);
+    if(ICS_ENGINE == ICS_ENGINE_BUDDY) check("flag ignored by buddy", growable == plain);
+    else check("ICS_GROWABLE copies less", growable < plain);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Fragmentation benchmark for workloads with many distinct request sizes:
+ * mostly small records of any length, some medium buffers and a few large
+ * ones. Reports operations per second, the allocations that failed in the
+ * fixed-size heap (external fragmentation), the internal fragmentation of the
+ * live blocks and, under ICS_SIZE_CLASSES, the classes in use. Failures are
+ * only counted after the first ICS_CLASS_WARMUP requests, in every build, so
+ * the adaptive build is measured with its classes in place. Compare
+ * bin/bench_size_classes-default.bin and bin/bench_size_classes-adaptive.bin.
+ *
+ * With a file argument the adaptive build starts from the classes stored in
+ * it and writes the classes it ends with back, so a second run skips the
+ * warm-up.
+ */
+
+#define SLOTS 128
+#define OPS 400000
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+#define BLOCK_OVERHEAD 0
+#else
+#define BLOCK_OVERHEAD (HEADER_SIZE + FOOTER_SIZE)
+#endif
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t
+request_size()
+{
+    switch(rand() % 10)
+    {
+        case 0: return 400 + rand() % 500;
+        case 1:
+        case 2:
+        case 3: return 120 + rand() % 200;
+        default: return 8 + rand() % 100;
+    }
+}
+
+static void
+print_classes(const char *path)
+{
+    ics_size_class_header header;
+    uint32_t size = 0;
+    unsigned int i = 0;
+    int fd = -1;
+
+    if( ( fd = open(path, O_RDONLY) ) == -1 ) return;
+    if(read(fd, &header, sizeof(header)) == sizeof(header))
+    {
+        printf("classes=%u:", header.count);
+        for(i = 0; i < header.count && read(fd, &size, sizeof(size)) == sizeof(size); ++i) printf(" %u", size);
+        printf("\n");
+    }
+    close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+    void *slots[SLOTS] = { 0 };
+    size_t sizes[SLOTS] = { 0 };
+    size_t failures = 0, requests = 0, requested = 0, footprint = 0;
+    uint64_t start = 0, elapsed = 0;
+    const char *path = argc > 1 ? argv[1] : NULL;
+    int i = 0, op = 0, fd = -1, loaded = 0;
+
+    ics_mem_init();
+    srand(53);
+
+    if(path && ( fd = open(path, O_RDONLY) ) != -1)
+    {
+        loaded = ics_size_classes_load(fd) == 0;
+        close(fd);
+    }
+
+    start = now_ns();
+    for(op = 0; op < OPS; ++op)
+    {
+        i = rand() % SLOTS;
+        if(slots[i])
+        {
+            ics_free(slots[i]);
+            slots[i] = NULL;
+            continue;
+        }
+
+        sizes[i] = request_size();
+        if( !( slots[i] = ics_malloc(sizes[i]) ) && requests >= ICS_CLASS_WARMUP ) ++failures;
+        ++requests;
+    }
+    elapsed = now_ns() - start;
+
+    for(i = 0; i < SLOTS; ++i)
+    {
+        if(!slots[i]) continue;
+        requested += sizes[i];
+        footprint += ics_usable_size(slots[i]) + BLOCK_OVERHEAD;
+    }
+
+    printf("classes: %s\n", loaded ? "loaded" : ICS_SIZE_CLASSES ? "derived" : "none");
+    printf("ops/sec=%.0f failed=%zu live=%zu bytes footprint=%zu bytes internal fragmentation=%.1f%%\n",
+           OPS * 1e9 / elapsed, failures, requested, footprint,
+           footprint ? 100.0 * (footprint - requested) / footprint : 0.0);
+
+    if(ICS_SIZE_CLASSES && path && ( fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) ) != -1)
+    {
+        if(ics_size_classes_export(fd) == 0) print_classes(path);
+        close(fd);
+    }
+
+    for(i = 0; i < SLOTS; ++i) ics_free(slots[i]);
+    ics_mem_fini();
+    return EXIT_SUCCESS;
+}
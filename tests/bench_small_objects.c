@@ -0,0 +1,74 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Footprint and throughput benchmark for small objects of 1 to 24 bytes.
+ * Keeps SLOTS objects live while replacing random ones, then reports the
+ * bytes the allocator holds per live object (block headers included), how
+ * many such objects fit in a page and in a cache line, and operations per
+ * second. Compare bin/bench_small_objects-default.bin with
+ * bin/bench_small_objects-compact.bin (ICS_COMPACT_LINKS, 8-byte granule).
+ */
+
+#define SLOTS 400
+#define OPS 400000
+#define MAX_OBJECT 24
+
+static uint64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t
+block_bytes(void *ptr)
+{
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+    return ics_usable_size(ptr);
+#else
+    return CLEAR_ALLOCATED_FLAG(GET_CURR_HEADER(ptr)->header.block_size);
+#endif
+}
+
+int
+main(int argc, char *argv[])
+{
+    void *slots[SLOTS] = { 0 };
+    size_t failures = 0, footprint = 0, live = 0;
+    uint64_t start = 0, elapsed = 0;
+    int i = 0, op = 0;
+
+    ics_mem_init();
+    srand(argc > 1 ? atoi(argv[1]) : 53);
+
+    start = now_ns();
+    for(op = 0; op < OPS; ++op)
+    {
+        i = rand() % SLOTS;
+        if(slots[i]) ics_free(slots[i]);
+        if( !( slots[i] = ics_malloc(1 + rand() % MAX_OBJECT) ) ) ++failures;
+    }
+    elapsed = now_ns() - start;
+
+    for(i = 0; i < SLOTS; ++i)
+    {
+        if(!slots[i]) continue;
+        ++live;
+        footprint += block_bytes(slots[i]);
+    }
+
+    printf("alignment=%d ops/sec=%.0f failed=%zu bytes/object=%.1f objects/page=%.1f objects/line=%.2f\n",
+           ALIGNMENT, OPS * 1e9 / elapsed, failures, live ? (double)footprint / live : 0.0,
+           footprint ? (double)PAGE_SIZE * live / footprint : 0.0,
+           footprint ? (double)ICS_CACHE_LINE * live / footprint : 0.0);
+
+    for(i = 0; i < SLOTS; ++i) ics_free(slots[i]);
+    ics_mem_fini();
+    return EXIT_SUCCESS;
+}
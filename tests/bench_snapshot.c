@@ -0,0 +1,168 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Round trip of ics_heap_snapshot. Objects of known sizes are allocated, some
+ * of them freed, and with ICS_THREAD_SAFE one is freed by another thread so it
+ * sits on the remote free list when the snapshot is taken. The snapshot is
+ * read back like tools/heapsnap.c reads it: the blocks must tile the heap, and
+ * the record of every object must show its requested size and whether it is
+ * allocated, a queued remote free counting as allocated. Under
+ * ICS_SIZE_CLASSES a class table is loaded first and allocated blocks must be
+ * counted in the class their request rounds up to. Buddy builds must refuse
+ * with ENOTSUP. Prints one line per check and exits with failure if any of
+ * them fails.
+ */
+
+#define OBJECTS 6
+#define QUEUED 5
+
+static const size_t sizes[OBJECTS] = { 24, 100, 200, 300, 40, 500 };
+static const int8_t freed[OBJECTS] = { 0, 1, 0, 1, 0, 0 };
+#if ICS_SIZE_CLASSES
+static const uint32_t classes[] = { 128, 512 };
+#endif
+static int failures = 0;
+
+static void
+check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    if(!ok) ++failures;
+}
+
+#if ICS_THREAD_SAFE
+static void*
+remote_free(void *ptr)
+{
+    check("remote free", ics_free(ptr) == 0);
+    return NULL;
+}
+#endif
+
+#if ICS_ENGINE != ICS_ENGINE_BUDDY
+static size_t
+expected_class(size_t blockSize)
+{
+#if ICS_SIZE_CLASSES
+    unsigned int i = 0;
+
+    for(i = 0; i < sizeof(classes) / sizeof(*classes); ++i)
+    {
+        if(classes[i] >= blockSize) return GET_SIZE_CLASS(classes[i]);
+    }
+#endif
+    return GET_SIZE_CLASS(blockSize);
+}
+
+static void
+load_classes()
+{
+#if ICS_SIZE_CLASSES
+    ics_size_class_header header = { ICS_SIZE_CLASS_MAGIC, ICS_SIZE_CLASS_VERSION, BLOCK_GRANULE, 2 };
+    int fds[2] = { -1, -1 };
+
+    check("class table", pipe(fds) == 0 &&
+          write(fds[1], &header, sizeof(header)) == sizeof(header) &&
+          write(fds[1], classes, sizeof(classes)) == sizeof(classes) &&
+          ics_size_classes_load(fds[0]) == 0);
+    close(fds[0]);
+    close(fds[1]);
+#endif
+}
+#endif
+
+int
+main(int argc, char *argv[])
+{
+    void *objects[OBJECTS];
+    ics_snapshot_header header;
+    ics_snapshot_block *records = NULL, *record = NULL;
+    uint32_t offset = 0, tiled = 1, found = 0, matches = 0, classMatches = 0, allocated = 0, i = 0, j = 0;
+    FILE *file = NULL;
+#if ICS_THREAD_SAFE
+    pthread_t thread;
+    int queued = 0;
+#endif
+
+    ics_mem_init();
+
+#if ICS_ENGINE == ICS_ENGINE_BUDDY
+    errno = 0;
+    check("buddy snapshot refused", ics_heap_snapshot(1) == -1 && errno == ENOTSUP);
+#else
+    load_classes();
+
+    for(i = 0; i < OBJECTS; ++i) objects[i] = ics_malloc(sizes[i]);
+    for(i = 0; i < OBJECTS; ++i)
+    {
+        if(freed[i]) ics_free(objects[i]);
+    }
+#if ICS_THREAD_SAFE
+    // Queued on this thread's heap, which drains it only at its next ics_malloc.
+    pthread_create(&thread, NULL, remote_free, objects[QUEUED]);
+    pthread_join(thread, NULL);
+#endif
+
+    check("snapshot written", ( file = tmpfile() ) && ics_heap_snapshot(fileno(file)) == 0);
+    if(file) rewind(file);
+    check("header read back", file && fread(&header, sizeof(header), 1, file) == 1 &&
+          header.magic == ICS_SNAPSHOT_MAGIC && header.version == ICS_SNAPSHOT_VERSION && header.alignment == ALIGNMENT);
+    check("every block read back", file && ( records = calloc(header.block_count + 1, sizeof(*records)) ) &&
+          fread(records, sizeof(*records), header.block_count, file) == header.block_count &&
+          fgetc(file) == EOF);
+    if(file) fclose(file);
+
+    for(i = 0; records && i < header.block_count; offset += records[i].block_size, ++i)
+    {
+        if(records[i].offset != offset || !records[i].block_size) tiled = 0;
+        allocated += records[i].allocated;
+    }
+    check("blocks tile the heap", records && tiled && offset == header.heap_size);
+    printf("blocks=%u allocated=%u heap=%u bytes\n", header.block_count, allocated, header.heap_size);
+
+    for(i = 0; records && i < OBJECTS; ++i)
+    {
+        offset = (char*)GET_CURR_HEADER(objects[i]) - ((char*)prologue + PROLOGUE_SIZE);
+        for(j = 0, record = NULL; j < header.block_count; ++j)
+        {
+            if(records[j].offset <= offset && offset < records[j].offset + records[j].block_size) record = &records[j];
+        }
+        if(!record) continue;
+        ++found;
+
+        if(freed[i])
+        {
+            matches += !record->allocated;
+            classMatches += 1;
+            continue;
+        }
+        matches += record->allocated && record->offset == offset && record->requested_size == sizes[i];
+#if ICS_THREAD_SAFE
+        if(i == QUEUED) queued = record->allocated && record->requested_size == sizes[i];
+#endif
+        classMatches += record->size_class ==
+                        ( ICS_SIZE_CLASSES ? expected_class(CALC_ACTUAL_BLOCK_SIZE(sizes[i])) : GET_SIZE_CLASS(record->block_size) );
+    }
+    check("every object found", found == OBJECTS);
+    check("allocated and requested sizes", matches == OBJECTS);
+    check("size classes", classMatches == OBJECTS);
+#if ICS_THREAD_SAFE
+    check("queued remote free reported allocated", queued);
+#endif
+
+    free(records);
+    for(i = 0; i < OBJECTS; ++i)
+    {
+        if(!freed[i] && (!ICS_THREAD_SAFE || i != QUEUED)) ics_free(objects[i]);
+    }
+#endif
+
+    ics_mem_fini();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
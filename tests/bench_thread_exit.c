@@ -0,0 +1,93 @@
+#include "icsmm.h"
+#include "helpers.h"
+#include "debug.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Check of heaps left behind by exited threads. Four times ICS_MAX_HEAPS
+ * short-lived threads run one after the other. Each allocates objects, frees
+ * half of them and leaves the other half to the main thread, which frees them
+ * after the thread has exited. Every allocation and free must succeed. With
+ * ICS_THREAD_SAFE every thread must adopt the heap of the one before instead
+ * of taking a slot of its own, and the frees queued on a heap while it had no
+ * owner must be drained by the thread that adopts it, and ics_mem_tune must
+ * refuse to change the heaps already reserved. Prints one line per
+ * check and exits with failure if any of them fails.
+ */
+
+#define THREADS (4 * ICS_MAX_HEAPS)
+#define OBJECTS 128
+#define OBJECT_SIZE 64
+
+static void *kept[OBJECTS / 2];
+static int allocated = 1, freed = 1, failures = 0;
+
+static void
+check(const char *name, int ok)
+{
+    printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+    if(!ok) ++failures;
+}
+
+static void*
+worker(void *arg)
+{
+    void *objects[OBJECTS];
+    int i = 0;
+
+    for(i = 0; i < OBJECTS; ++i)
+    {
+        if( !( objects[i] = ics_malloc(OBJECT_SIZE) ) ) allocated = 0;
+    }
+    for(i = 0; i < OBJECTS; ++i)
+    {
+        if(i % 2) kept[i / 2] = objects[i];
+        else if(objects[i] && ics_free(objects[i]) != 0) freed = 0;
+    }
+
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t thread;
+    int i = 0, j = 0, drained = 1;
+
+    ics_mem_init();
+
+    for(i = 0; i < THREADS; ++i)
+    {
+        pthread_create(&thread, NULL, worker, NULL);
+        pthread_join(thread, NULL);
+
+        for(j = 0; j < OBJECTS / 2; ++j)
+        {
+            if(kept[j] && ics_free(kept[j]) != 0) freed = 0;
+        }
+    }
+
+    // One more thread takes over the frees queued after the last one exited.
+    for(i = 0; i < OBJECTS / 2; ++i) kept[i] = NULL;
+    pthread_create(&thread, NULL, worker, NULL);
+    pthread_join(thread, NULL);
+
+    check("all allocations succeeded", allocated);
+    check("all frees succeeded", freed);
+#if ICS_THREAD_SAFE
+    printf("heaps=%u\n", heapCount);
+    check("exited threads' heaps adopted", heapCount == 1);
+    for(i = 0; i < (int)heapCount; ++i)
+    {
+        if(heaps[i].remoteFrees) drained = 0;
+    }
+    check("queued frees drained on adoption", drained);
+    check("tuning refused once heaps exist", ics_mem_tune(ICS_RESERVE_SIZE, 1) == -1 && errno == EINVAL);
+    check("process-wide heap symbols stay empty", !prologue && !pagesCount);
+#endif
+
+    ics_mem_fini();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+#include "icsmm.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/*
+ * Offline viewer for the files written by ics_heap_snapshot().
+ *
+ * usage: heapsnap.bin <snapshot> [bytes-per-cell]
+ *
+ * Prints a heatmap of the heap, one row per PAGE_SIZE bytes by default, where
+ * every cell shows how much of its bytes are held by allocated blocks, followed
+ * by fragmentation metrics and the block count per size class.
+ */
+
+#define CELLS_PER_ROW 64
+#define SHADES " .:-=+*#%@"
+#define SHADE_LEVELS (sizeof(SHADES) - 2)
+
+
+static void
+printHeatmap(ics_snapshot_block *blocks, uint32_t blockCount, uint32_t heapSize, uint32_t cellSize)
+{
+    uint32_t cellStart = 0, cellEnd = 0, overlapStart = 0, overlapEnd = 0, allocated = 0, i = 0, cell = 0;
+
+    printf("heatmap (%u bytes per cell, '%c' free .. '%c' allocated)\n",
+           cellSize, SHADES[0], SHADES[SHADE_LEVELS]);
+
+    for(cellStart = 0; cellStart < heapSize; cellStart += cellSize, ++cell)
+    {
+        cellEnd = (cellStart + cellSize < heapSize) ? cellStart + cellSize : heapSize;
+        allocated = 0;
+
+        while(i < blockCount && blocks[i].offset + blocks[i].block_size <= cellStart) ++i;
+        for(uint32_t j = i; j < blockCount && blocks[j].offset < cellEnd; ++j)
+        {
+            if(!blocks[j].allocated) continue;
+            overlapStart = (blocks[j].offset > cellStart) ? blocks[j].offset : cellStart;
+            overlapEnd = (blocks[j].offset + blocks[j].block_size < cellEnd) ? blocks[j].offset + blocks[j].block_size : cellEnd;
+            allocated += overlapEnd - overlapStart;
+        }
+
+        if(cell % CELLS_PER_ROW == 0) printf("%s%08x |", cell ? "|\n" : "", cellStart);
+        putchar(SHADES[(allocated * SHADE_LEVELS + cellEnd - cellStart - 1) / (cellEnd - cellStart)]);
+    }
+    printf("|\n\n");
+}
+
+static void
+printMetrics(ics_snapshot_block *blocks, uint32_t blockCount, uint32_t heapSize)
+{
+    uint64_t allocatedBytes = 0, requestedBytes = 0, freeBytes = 0, largestFree = 0;
+    uint32_t freeBlocks = 0, i = 0, sizeClass = 0, maxClass = 0;
+    uint32_t *classCounts = NULL;
+
+    for(i = 0; i < blockCount; ++i)
+    {
+        if(blocks[i].allocated)
+        {
+            allocatedBytes += blocks[i].block_size;
+            requestedBytes += blocks[i].requested_size;
+        }
+        else
+        {
+            ++freeBlocks;
+            freeBytes += blocks[i].block_size;
+            if(blocks[i].block_size > largestFree) largestFree = blocks[i].block_size;
+        }
+        if(blocks[i].size_class > maxClass) maxClass = blocks[i].size_class;
+    }
+
+    printf("heap size:              %u bytes in %u blocks\n", heapSize, blockCount);
+    printf("allocated:              %lu bytes (%lu requested)\n", allocatedBytes, requestedBytes);
+    printf("free:                   %lu bytes in %u blocks\n", freeBytes, freeBlocks);
+    printf("largest free block:     %lu bytes\n", largestFree);
+    printf("external fragmentation: %.2f%% (1 - largest free / total free)\n",
+           freeBytes ? 100.0 * (1.0 - (double)largestFree / freeBytes) : 0.0);
+    printf("internal fragmentation: %.2f%% (1 - requested / allocated)\n",
+           allocatedBytes ? 100.0 * (1.0 - (double)requestedBytes / allocatedBytes) : 0.0);
+    printf("utilization:            %.2f%% (requested / heap size)\n\n",
+           heapSize ? 100.0 * requestedBytes / heapSize : 0.0);
+
+    if( !( classCounts = calloc(maxClass + 1, sizeof(*classCounts)) ) ) return;
+    for(i = 0; i < blockCount; ++i) classCounts[blocks[i].size_class] += blocks[i].allocated;
+
+    printf("allocated blocks per size class:\n");
+    for(sizeClass = 0; sizeClass <= maxClass; ++sizeClass)
+    {
+        if(classCounts[sizeClass]) printf("  class %-5u %u\n", sizeClass, classCounts[sizeClass]);
+    }
+    free(classCounts);
+}
+
+int
+main(int argc, char *argv[])
+{
+    ics_snapshot_header header;
+    ics_snapshot_block *blocks = NULL;
+    uint32_t cellSize = PAGE_SIZE / CELLS_PER_ROW;
+    FILE *file = NULL;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s <snapshot> [bytes-per-cell]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(argc > 2 && (cellSize = strtoul(argv[2], NULL, 10)) == 0)
+    {
+        error("invalid cell size: %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    if( !( file = fopen(argv[1], "rb") ) )
+    {
+        error("cannot open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if( fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != ICS_SNAPSHOT_MAGIC ||
+        header.version != ICS_SNAPSHOT_VERSION )
+    {
+        error("%s is not an ics heap snapshot\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    if( !( blocks = calloc(header.block_count + 1, sizeof(*blocks)) ) ||
+        fread(blocks, sizeof(*blocks), header.block_count, file) != header.block_count )
+    {
+        error("%s is truncated\n", argv[1]);
+        free(blocks);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+    fclose(file);
+
+    if(header.heap_size) printHeatmap(blocks, header.block_count, header.heap_size, cellSize);
+    printMetrics(blocks, header.block_count, header.heap_size);
+
+    free(blocks);
+    return EXIT_SUCCESS;
+}